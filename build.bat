@@ -1,5 +1,8 @@
 @echo off
 
+set EXAMPLE=%1
+if "%EXAMPLE%"=="" set EXAMPLE=example
+
 mkdir .\bin
 pushd .\bin
 
@@ -8,7 +11,7 @@ cl /MD /std:c++17 ^
 	/wd4005 ^
 	/I"..\src" /I"..\libs" ^
 	/DGLFW_EXPOSE_NATIVE_WIN32 ^
-	..\examples\example.cc ^
+	..\examples\%EXAMPLE%.cc ^
     ..\libs\glad.cc ^
 	..\libs\fmt\format.cc ^
 	..\libs\imgui\imgui.cpp ^
@@ -20,4 +23,4 @@ cl /MD /std:c++17 ^
 	kernel32.lib  shell32.lib user32.lib gdi32.lib comdlg32.lib glu32.lib glfw3.lib opengl32.lib ^
 	/link /LIBPATH:C:\work\projects\playgl\libs
 
-popd
\ No newline at end of file
+popd
@@ -10,8 +10,12 @@ uniform mat4 world;
 uniform mat4 view;
 uniform mat4 projection;
 
+#include "quantization.glsl"
+
 void main() {
-    gl_Position = vec4(IN_POSITION, 1.0) * world * view * projection;
-    OUT_NORAML = IN_NORMAL * mat3(inverse(transpose(world)));
-    OUT_FRAGMENT_POSITION = vec3(vec4(IN_POSITION, 1.0) * world);
+    vec3 position = decode_position(IN_POSITION);
+    vec3 normal = decode_normal(IN_NORMAL);
+    gl_Position = vec4(position, 1.0) * world * view * projection;
+    OUT_NORAML = normal * mat3(inverse(transpose(world)));
+    OUT_FRAGMENT_POSITION = vec3(vec4(position, 1.0) * world);
 }
\ No newline at end of file
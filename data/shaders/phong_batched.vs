@@ -0,0 +1,33 @@
+#version 460 core
+
+in vec3 IN_POSITION;
+in vec3 IN_NORMAL;
+
+struct Object {
+    mat4 world;
+    vec4 color;
+};
+
+layout(std430, binding = 0) readonly buffer ObjectData {
+    Object objects[];
+};
+
+out vec3 OUT_NORAML;
+out vec3 OUT_FRAGMENT_POSITION;
+out vec4 OUT_INSTANCE_COLOR;
+
+uniform mat4 view;
+uniform mat4 projection;
+
+#include "quantization.glsl"
+
+void main() {
+    Object object = objects[gl_BaseInstance];
+    vec3 position = decode_position(IN_POSITION);
+    vec3 normal = decode_normal(IN_NORMAL);
+    vec4 world_position = vec4(position, 1.0) * object.world;
+    gl_Position = world_position * view * projection;
+    OUT_NORAML = normal * mat3(inverse(transpose(object.world)));
+    OUT_FRAGMENT_POSITION = vec3(world_position);
+    OUT_INSTANCE_COLOR = object.color;
+}
\ No newline at end of file
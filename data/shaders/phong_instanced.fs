@@ -0,0 +1,23 @@
+#version 330 core
+
+out vec4 FragColor;
+
+in vec3 OUT_NORAML;
+in vec3 OUT_FRAGMENT_POSITION;
+in vec4 OUT_INSTANCE_COLOR;
+
+#pragma store
+#ifdef STORE_LIGHT_COLOR
+#define LIGHT_COLOR store.LIGHT_COLOR
+#else
+uniform vec4 LIGHT_COLOR;
+#endif
+
+#include "phong_lighting.glsl"
+
+void main() {
+    vec4 light = phong_lighting(OUT_NORAML, OUT_FRAGMENT_POSITION,
+                                LIGHT_COLOR);
+    vec4 result = light * OUT_INSTANCE_COLOR;
+    FragColor = vec4(result.rgb, 1.0);
+}
\ No newline at end of file
@@ -0,0 +1,25 @@
+#version 330 core
+
+in vec3 IN_POSITION;
+in vec3 IN_NORMAL;
+in mat4 IN_INSTANCE_WORLD;
+in vec4 IN_INSTANCE_COLOR;
+
+out vec3 OUT_NORAML;
+out vec3 OUT_FRAGMENT_POSITION;
+out vec4 OUT_INSTANCE_COLOR;
+
+uniform mat4 view;
+uniform mat4 projection;
+
+#include "quantization.glsl"
+
+void main() {
+    vec3 position = decode_position(IN_POSITION);
+    vec3 normal = decode_normal(IN_NORMAL);
+    vec4 world_position = vec4(position, 1.0) * IN_INSTANCE_WORLD;
+    gl_Position = world_position * view * projection;
+    OUT_NORAML = normal * mat3(inverse(transpose(IN_INSTANCE_WORLD)));
+    OUT_FRAGMENT_POSITION = vec3(world_position);
+    OUT_INSTANCE_COLOR = IN_INSTANCE_COLOR;
+}
\ No newline at end of file
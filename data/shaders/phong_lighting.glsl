@@ -0,0 +1,37 @@
+// Phong lighting of a surface point by a point light at `light_pos`, viewed
+// from `view_pos`
+//
+// PHONG_SPECULAR can be specialized from the store (see shader_variants.h);
+// highlights are on unless it is defined as 0
+
+#ifndef PHONG_SPECULAR
+#define PHONG_SPECULAR 1
+#endif
+
+uniform vec3 light_pos;
+uniform vec3 view_pos;
+
+vec4 phong_lighting(vec3 normal, vec3 position, vec4 light_color) {
+    // ambient
+    float ambientStrength = 0.15;
+    vec4 ambient = ambientStrength * light_color;
+
+    // diffuse
+    vec3 norm = normalize(normal);
+    vec3 lightDir = normalize(light_pos - position);
+    float diff = max(dot(norm, lightDir), 0.0);
+    vec4 diffuse = diff * light_color;
+
+    vec4 result = ambient + diffuse;
+
+#if PHONG_SPECULAR
+    // specular
+    float specularStrength = 0.5;
+    vec3 viewDir = normalize(view_pos - position);
+    vec3 reflectDir = reflect(-lightDir, norm);
+    float spec = pow(max(dot(viewDir, reflectDir), 0.0), 32);
+    result += specularStrength * spec * light_color;
+#endif
+
+    return result;
+}
\ No newline at end of file
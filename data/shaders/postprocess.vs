@@ -1,8 +1,12 @@
-#version 330 core
+#version 410 core
 
 in vec3 IN_POSITION;
 in vec2 IN_TEXCOORD;
 
+out gl_PerVertex {
+    vec4 gl_Position;
+};
+
 out vec2 tex_coords;
 uniform mat4 transform;
 
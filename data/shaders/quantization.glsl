@@ -0,0 +1,23 @@
+// Decoding of quantized vertices (see vertex_quantization.h); a no-op for
+// float vertices
+uniform bool QUANTIZED;
+uniform vec3 QUANTIZATION_OFFSET;
+uniform vec3 QUANTIZATION_SCALE;
+
+vec3 decode_position(vec3 position) {
+    return QUANTIZED ? QUANTIZATION_OFFSET + position * QUANTIZATION_SCALE
+                     : position;
+}
+
+vec3 decode_normal(vec3 normal) {
+    if (!QUANTIZED) {
+        return normal;
+    }
+
+    // octahedral
+    vec3 n = vec3(normal.xy, 1.0 - abs(normal.x) - abs(normal.y));
+    float t = max(-n.z, 0.0);
+    n.x += n.x >= 0.0 ? -t : t;
+    n.y += n.y >= 0.0 ? -t : t;
+    return normalize(n);
+}
\ No newline at end of file
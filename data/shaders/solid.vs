@@ -9,8 +9,10 @@ uniform mat4 world;
 uniform mat4 view;
 uniform mat4 projection;
 
+#include "quantization.glsl"
+
 void main() {
-    gl_Position = vec4(IN_POSITION, 1.0) *
+    gl_Position = vec4(decode_position(IN_POSITION), 1.0) *
                   world * view * projection;
     tex_coord = IN_TEXCOORD;
 }
@@ -0,0 +1,16 @@
+#version 460 core
+
+in vec3 IN_POSITION;
+
+layout(std430, binding = 0) readonly buffer ObjectData {
+    mat4 worlds[];
+};
+
+uniform mat4 view;
+uniform mat4 projection;
+
+void main() {
+    mat4 world = worlds[gl_BaseInstance];
+    gl_Position = vec4(IN_POSITION, 1.0) *
+                  world * view * projection;
+}
\ No newline at end of file
@@ -0,0 +1,134 @@
+#define PGL_DEFINE_MAIN
+#include "playgl.h"
+
+// NOTE(panmar): Compares per-draw cpu time of a ~1M vertex mesh drawn through
+// the content-hashed path (raw Geometry) and through a registered handle.
+// The gpu time of the handle draw is measured for the selected vertex layout,
+// with float or quantized vertices.
+
+using BenchmarkClock = std::chrono::high_resolution_clock;
+
+const geometry::Sphere<999, 999>& benchmark_mesh() {
+    static geometry::Sphere<999, 999> mesh;
+    return mesh;
+}
+
+GeometryHandle& benchmark_handle(System& system) {
+    static auto handle = system.geometry.add(benchmark_mesh());
+    return handle;
+}
+
+void pgl_init(Store& store) {
+    store["PHONG_COLOR"] = Color(0.7f, 0.4f, 0.3f);
+    store["LIGHT_COLOR"] = Color(0.8f, 0.2f, 0.4f);
+
+    store["vertex_count"] = static_cast<i32>(benchmark_mesh().positions.size());
+    store["raw_draw_ms"] = 0.f;
+    store["handle_draw_ms"] = 0.f;
+    store["handle_gpu_ms"] = 0.f;
+    store["interleaved"] = 1;
+    store["quantized"] = 0;
+
+    auto report = quantization::report(benchmark_mesh());
+    fmt::print(
+        "quantized vertex: {} -> {} bytes, max position error {:.6f} "
+        "({:.4f}% of extent), max normal error {:.3f} deg\n",
+        report.float_vertex_size, report.quantized_vertex_size,
+        report.max_position_error, report.max_relative_position_error * 100.f,
+        report.max_normal_error_degrees);
+}
+
+void pgl_update(System& system) {
+    i32 interleaved = system.store["interleaved"];
+    system.geometry.vertex_layout(interleaved ? VertexLayout::Interleaved
+                                              : VertexLayout::Separate);
+
+    static i32 quantized = 0;
+    i32 requested_quantized = system.store["quantized"];
+    if (requested_quantized != quantized) {
+        quantized = requested_quantized;
+        auto mesh = Geometry(benchmark_mesh());
+        mesh.quantized = quantized;
+        system.geometry.update(benchmark_handle(system), std::move(mesh));
+    }
+}
+
+template <class DrawFunc>
+f32 measure_draw_ms(DrawFunc draw) {
+    auto start = BenchmarkClock::now();
+    draw();
+    std::chrono::duration<f32, std::milli> elapsed =
+        BenchmarkClock::now() - start;
+    return elapsed.count();
+}
+
+void pgl_render(System& system) {
+    auto& handle = benchmark_handle(system);
+    static u32 frame = 0;
+
+    auto draw = [&system](auto&& geometry, const mat4& world) {
+        system.geometry(geometry)
+            .shader("phong.vs", "phong.fs")
+            .param("world", world)
+            .param("view", system.camera.geometry.get_view())
+            .param("projection", system.camera.geometry.get_projection())
+            .render();
+    };
+
+    auto raw_ms = measure_draw_ms([&] {
+        draw(benchmark_mesh(), glm::translate(vec3(-1.5f, 0.f, 0.f)));
+    });
+
+    // NOTE(panmar): A ring of timer queries, only read back once available,
+    // so waiting on the gpu never ends up in the cpu timings
+    static array<u32, 4> gpu_queries = {};
+    static array<bool, 4> gpu_query_pending = {};
+    if (!gpu_queries[0]) {
+        glGenQueries(static_cast<i32>(gpu_queries.size()), gpu_queries.data());
+    }
+
+    for (size_t i = 0; i < gpu_queries.size(); ++i) {
+        if (!gpu_query_pending[i]) {
+            continue;
+        }
+        i32 available = GL_FALSE;
+        glGetQueryObjectiv(gpu_queries[i], GL_QUERY_RESULT_AVAILABLE,
+                           &available);
+        if (available) {
+            u64 elapsed_ns = 0;
+            glGetQueryObjectui64v(gpu_queries[i], GL_QUERY_RESULT, &elapsed_ns);
+            f32& handle_gpu_ms = system.store["handle_gpu_ms"];
+            handle_gpu_ms = glm::mix(handle_gpu_ms, elapsed_ns / 1e6f, 0.05f);
+            gpu_query_pending[i] = false;
+        }
+    }
+
+    auto free_query = std::find(gpu_query_pending.begin(),
+                                gpu_query_pending.end(), false);
+    auto query_index = free_query - gpu_query_pending.begin();
+    auto has_query = free_query != gpu_query_pending.end();
+
+    if (has_query) {
+        glBeginQuery(GL_TIME_ELAPSED, gpu_queries[query_index]);
+    }
+    auto handle_ms = measure_draw_ms(
+        [&] { draw(handle, glm::translate(vec3(1.5f, 0.f, 0.f))); });
+    if (has_query) {
+        glEndQuery(GL_TIME_ELAPSED);
+        gpu_query_pending[query_index] = true;
+    }
+
+    // NOTE(panmar): The first frame includes the upload for both paths
+    if (++frame > 1) {
+        auto smoothing = (frame == 2) ? 1.f : 0.05f;
+        f32& raw_avg = system.store["raw_draw_ms"];
+        f32& handle_avg = system.store["handle_draw_ms"];
+        raw_avg = glm::mix(raw_avg, raw_ms, smoothing);
+        handle_avg = glm::mix(handle_avg, handle_ms, smoothing);
+
+        if (frame % 100 == 0) {
+            fmt::print("per-draw cpu: raw {:.3f} ms, handle {:.3f} ms\n",
+                       raw_avg, handle_avg);
+        }
+    }
+}
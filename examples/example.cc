@@ -5,12 +5,53 @@ void pgl_init(Store& store) {
     store["screen_color"] = Color(0.5f, 0.5f, 0.5);
     store["PHONG_COLOR"] = Color(0.7f, 0.4f, 0.3f);
     store["LIGHT_COLOR"] = Color(0.8f, 0.2f, 0.4f);
+    // NOTE(panmar): Toggling it switches phong programs instead of branching
+    store["PHONG_SPECULAR"] = SpecializedParam(1, 0, 1);
 
     store["test_bounded"] = BoundedParam(vec4(-1.f, 15.f, 32.f, -3.f), -5, 50);
+
+    auto print_report = [](const char* name, Geometry geometry) {
+        auto report = geometry::optimize(geometry);
+        fmt::print("{}: ACMR {:.3f} -> {:.3f}, ATVR {:.3f} -> {:.3f}\n", name,
+                   report.acmr_before, report.acmr_after, report.atvr_before,
+                   report.atvr_after);
+    };
+    print_report("TrefoilKnot", geometry::TrefoilKnot<>{});
+    print_report("Torus", geometry::Torus<>{});
+
+    auto print_weld_report = [](const char* name,
+                                const geometry::WeldReport& report) {
+        fmt::print("{}: {} -> {} vertices, {} -> {} vertex invocations\n",
+                   name, report.vertices_before, report.vertices_after,
+                   report.invocations_before, report.invocations_after);
+    };
+    geometry::WeldReport report;
+    geometry::Isohedron{&report};
+    print_weld_report("Isohedron", report);
+    geometry::Dodecahedron{&report};
+    print_weld_report("Dodecahedron", report);
+    geometry::Sphere<>{&report};
+    print_weld_report("Sphere", report);
+    geometry::TrefoilKnot<>{1.f, &report};
+    print_weld_report("TrefoilKnot", report);
 }
 
 void pgl_update(System& system) {
     system.camera.canvas.color = system.store["screen_color"];
+
+    static u32 frame = 0;
+    if (++frame % 100 == 0) {
+        auto& stats = Shader::uniform_stats();
+        fmt::print(
+            "uniforms: {} location hits, {} misses, {} uploads, {} skipped\n",
+            stats.location_hits, stats.location_misses, stats.uploads,
+            stats.uploads_skipped);
+
+        auto& store_stats = system.store_buffer.stats();
+        fmt::print("store block: {} params, {} bytes, {} bytes uploaded\n",
+                   store_stats.members, store_stats.size,
+                   store_stats.bytes_uploaded);
+    }
 };
 
 void pgl_render(System& system) {
@@ -0,0 +1,128 @@
+#define PGL_DEFINE_MAIN
+#include "playgl.h"
+
+// NOTE(panmar): Stress test rendering 100k isohedrons either with a single
+// instanced draw, or with one command per instance. Per-command draws pass
+// world and color either as uniforms, or with `batched` as object data read
+// from a storage buffer, which lets the deferred queue merge them into
+// multi-draws. The cpu time spent in submission is reported for the selected
+// path; in deferred mode it covers only recording, and the binds skipped by
+// the sorted queue are reported.
+
+using BenchmarkClock = std::chrono::high_resolution_clock;
+
+constexpr i32 instances_per_axis = 47;
+
+// NOTE(panmar): Matches `Object` in phong_batched.vs
+struct ObjectConstants {
+    mat4 world;
+    Color color;
+};
+
+struct Instances {
+    vector<mat4> worlds;
+    vector<Color> colors;
+};
+
+const Instances& benchmark_instances() {
+    static Instances instances = [] {
+        Instances result;
+        auto half_extent = instances_per_axis * 0.5f;
+        for (i32 x = 0; x < instances_per_axis; ++x) {
+            for (i32 y = 0; y < instances_per_axis; ++y) {
+                for (i32 z = 0; z < instances_per_axis; ++z) {
+                    auto position = vec3(x, y, z) - vec3(half_extent);
+                    result.worlds.push_back(glm::translate(position) *
+                                            glm::scale(vec3(0.3f)));
+                    result.colors.push_back(Colors::random());
+                }
+            }
+        }
+        return result;
+    }();
+    return instances;
+}
+
+void pgl_init(Store& store) {
+    store["LIGHT_COLOR"] = Color(0.8f, 0.2f, 0.4f);
+
+    store["instance_count"] =
+        static_cast<i32>(benchmark_instances().worlds.size());
+    store["instanced"] = 1;
+    store["batched"] = 0;
+    store["deferred"] = 0;
+    store["submit_ms"] = 0.f;
+}
+
+void pgl_update(System& system) {
+    i32 deferred = system.store["deferred"];
+    system.geometry.deferred(deferred);
+}
+
+void pgl_render(System& system) {
+    static auto isohedron = system.geometry.add(geometry::Isohedron{});
+    static i32 previous_path = -1;
+    static u32 frame = 0;
+
+    auto& instances = benchmark_instances();
+    i32 instanced = system.store["instanced"];
+    i32 batched = system.store["batched"];
+
+    auto start = BenchmarkClock::now();
+    if (instanced) {
+        system.geometry(isohedron)
+            .shader("phong_instanced.vs", "phong_instanced.fs")
+            .instances(instances.worlds)
+            .instance_colors(instances.colors)
+            .param("view", system.camera.geometry.get_view())
+            .param("projection", system.camera.geometry.get_projection())
+            .render();
+    } else if (!batched) {
+        for (u32 i = 0; i < instances.worlds.size(); ++i) {
+            system.geometry(isohedron)
+                .shader("phong.vs", "phong.fs")
+                .param("world", instances.worlds[i])
+                .param("view", system.camera.geometry.get_view())
+                .param("projection", system.camera.geometry.get_projection())
+                .param("PHONG_COLOR", instances.colors[i])
+                .render();
+        }
+    } else {
+        for (u32 i = 0; i < instances.worlds.size(); ++i) {
+            system.geometry(isohedron)
+                .shader("phong_batched.vs", "phong_instanced.fs")
+                .object_data(ObjectConstants{
+                    glm::transpose(instances.worlds[i]), instances.colors[i]})
+                .param("view", system.camera.geometry.get_view())
+                .param("projection", system.camera.geometry.get_projection())
+                .render();
+        }
+    }
+    std::chrono::duration<f32, std::milli> elapsed =
+        BenchmarkClock::now() - start;
+
+    // NOTE(panmar): Restart averaging when switching between the paths
+    auto path = instanced ? 0 : batched ? 1 : 2;
+    if (path != previous_path) {
+        previous_path = path;
+        frame = 0;
+    }
+
+    f32& submit_ms = system.store["submit_ms"];
+    submit_ms = glm::mix(submit_ms, elapsed.count(), frame++ ? 0.05f : 1.f);
+
+    if (frame % 100 == 0) {
+        auto& stats = system.geometry.queue_stats();
+        fmt::print("{} submission: {:.3f} ms\n",
+                   instanced ? "instanced"
+                   : batched ? "batched per-command"
+                             : "per-command",
+                   submit_ms);
+        fmt::print(
+            "  draws {}, binds saved: shader {}, state {}, vao {}, "
+            "vertex buffer {}, framebuffer {}\n",
+            stats.draws, stats.shader_binds_saved, stats.state_binds_saved,
+            stats.vertex_array_binds_saved, stats.vertex_buffer_binds_saved,
+            stats.framebuffer_binds_saved);
+    }
+}
\ No newline at end of file
@@ -5,9 +5,13 @@
 #include <assert.h>
 #include <chrono>
 #include <cstdint>
+#include <cstring>
 #include <exception>
 #include <filesystem>
 #include <fmt/core.h>
+#include <functional>
+#include <limits>
+#include <list>
 #include <map>
 #include <memory>
 #include <numeric>
@@ -15,9 +19,11 @@
 #include <set>
 #include <stdexcept>
 #include <string>
+#include <string_view>
 #include <type_traits>
 #include <unordered_map>
 #include <unordered_set>
+#include <utility>
 #include <vector>
 #include <variant>
 
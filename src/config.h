@@ -12,11 +12,41 @@ auto window_height = 1200;
 
 auto key_quit = GLFW_KEY_ESCAPE;
 auto key_camera_rotate = GLFW_MOUSE_BUTTON_RIGHT;
+auto key_reload_shaders = GLFW_KEY_F5;
 
 constexpr auto multisampling = true;
 constexpr auto inverse_depth = true;
 constexpr auto frame_time = 32ms;
 
+// NOTE(panmar): Size of a single frame region of the geometry stream buffer
+constexpr u32 stream_buffer_frame_size = 16 * 1024 * 1024;
+
+// NOTE(panmar): Size of a single page of the shared vertex pool
+constexpr u32 vertex_pool_page_size = 32 * 1024 * 1024;
+
+// NOTE(panmar): Size of a single frame region of the per-draw data stream
+// (batched world matrices and indirect commands)
+constexpr u32 draw_stream_buffer_frame_size = 4 * 1024 * 1024;
+
+// NOTE(panmar): Content-hashed gpu buffers are evicted once they exceed the
+// budget, or when they have not been drawn for the given number of frames
+constexpr u64 gpu_buffer_cache_budget = 256 * 1024 * 1024;
+constexpr u64 gpu_buffer_cache_max_unused_frames = 600;
+
+// NOTE(panmar): Reorder imported meshes for vertex cache, overdraw and vertex
+// fetch locality; the ACMR/ATVR before and after are kept in each ModelPart
+constexpr auto optimize_imported_meshes = false;
+
+// NOTE(panmar): Linked shader programs are cached on disk and restored on
+// later runs instead of compiling them again
+constexpr auto shader_binary_cache = true;
+constexpr const char* shader_binary_cache_dir = "cache/shaders/";
+
+// NOTE(panmar): Shader programs in the data directory are compiled ahead at
+// startup, in parallel where the driver supports it; draws using a program
+// still being compiled are skipped
+constexpr auto precompile_shaders = true;
+
 auto gamma = 2.2f;
 
 }  // namespace config
\ No newline at end of file
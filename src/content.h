@@ -2,12 +2,17 @@
 
 #include "common.h"
 #include "graphics/model.h"
+#include "graphics/sampler.h"
 #include "graphics/texture.h"
 #include "graphics/shader.h"
+#include "graphics/shader_variants.h"
+#include "store.h"
 
 class Content {
 public:
-    Content(std::filesystem::path& data_dir) {
+    Content(std::filesystem::path& data_dir)
+        : shader_preprocessor(
+              [this](const string& id) { return resource_path(id); }) {
         for (const auto& entry :
              std::filesystem::recursive_directory_iterator{data_dir}) {
             if (entry.is_regular_file()) {
@@ -46,33 +51,138 @@ public:
             return it->second;
         }
 
-        auto vs_path_it =
-            std::find_if(resource_filepaths.begin(), resource_filepaths.end(),
-                         [&vs_id](const std::filesystem::path& p) {
-                             return vs_id == p.filename();
-                         });
+        auto shader = Shader::from_file(resource_path(vs_id),
+                                        resource_path(fs_id),
+                                        &shader_preprocessor);
+        return id_to_shaders.insert({id, std::move(shader)}).first->second;
+    }
 
-        if (vs_path_it == resource_filepaths.end()) {
-            string error = fmt::format("Cannot find resource {}", vs_id);
-            throw PlayGlException(error);
+    Shader& shader(const string& id) { return shader(id, id); }
+
+    // NOTE(panmar): The variant of the program for the given defines and the
+    // current values of the specialized store params it uses; see
+    // shader_variants.h
+    Shader& shader(const string& vs_id, const string& fs_id,
+                   const ShaderDefines& defines, Store& store) {
+        auto id = vs_id + "+" + fs_id;
+        for (auto& define : defines) {
+            id += "#" + define;
         }
 
-        auto fs_path_it =
-            std::find_if(resource_filepaths.begin(), resource_filepaths.end(),
-                         [&fs_id](const std::filesystem::path& p) {
-                             return fs_id == p.filename();
-                         });
+        auto it = id_to_shader_variants.find(id);
+        if (it == id_to_shader_variants.end()) {
+            auto base = defines.empty() ? &shader(vs_id, fs_id) : nullptr;
+            it = id_to_shader_variants
+                     .insert({id, ShaderVariants(resource_path(vs_id),
+                                                 resource_path(fs_id), defines,
+                                                 shader_preprocessor, base)})
+                     .first;
+        }
+        return it->second.select(store);
+    }
 
-        if (fs_path_it == resource_filepaths.end()) {
-            string error = fmt::format("Cannot find resource {}", fs_id);
-            throw PlayGlException(error);
+    // NOTE(panmar): Submits the shader programs found in the data directory
+    // for asynchronous compilation, so they are not compiled on the render
+    // thread on first use. They are selected the way the renderer selects
+    // them:
+    //
+    //  - `name.vs` is paired with `name.fs` into a program
+    //  - `name_batched.vs` is paired with `name.fs` and `name_*.fs`
+    //  - the other fragment shaders, and `postprocess.fs` itself, are
+    //    postprocess passes, a pipeline with the `postprocess.vs` stage
+    //
+    // Pairs that do not follow the naming can be submitted with
+    // `precompile_shader`. Variants for the current values of specialized
+    // store params are the ones compiled.
+    void precompile_shaders(Store& store) {
+        constexpr std::string_view batched_suffix = "_batched";
+
+        unordered_set<string> vertex_shaders;
+        vector<string> fragment_shaders;
+        for (auto& path : resource_filepaths) {
+            if (path.extension() == ".vs") {
+                vertex_shaders.insert(path.stem().string());
+            } else if (path.extension() == ".fs") {
+                fragment_shaders.push_back(path.stem().string());
+            }
         }
 
-        auto shader = Shader::from_file(*vs_path_it, *fs_path_it);
-        return id_to_shaders.insert({id, std::move(shader)}).first->second;
+        for (auto& name : fragment_shaders) {
+            if (name != "postprocess" && vertex_shaders.count(name)) {
+                precompile_shader(name + ".vs", name + ".fs", store);
+            } else if (vertex_shaders.count("postprocess")) {
+                shader_pipeline("postprocess.vs", name + ".fs").compile_async();
+            }
+        }
+
+        for (auto& vertex_shader : vertex_shaders) {
+            if (vertex_shader.size() <= batched_suffix.size() ||
+                !std::equal(batched_suffix.rbegin(), batched_suffix.rend(),
+                            vertex_shader.rbegin())) {
+                continue;
+            }
+
+            auto base = vertex_shader.substr(
+                0, vertex_shader.size() - batched_suffix.size());
+            for (auto& name : fragment_shaders) {
+                if (name == base || name.rfind(base + "_", 0) == 0) {
+                    precompile_shader(vertex_shader + ".vs", name + ".fs",
+                                      store);
+                }
+            }
+        }
     }
 
-    Shader& shader(const string& id) { return shader(id, id); }
+    // NOTE(panmar): A program pipeline of separately compiled stages; a stage
+    // is compiled once and shared by all pipelines using it, e.g. the
+    // postprocess vertex shader by every postprocess pass
+    Shader& shader_pipeline(const string& vs_id, const string& fs_id) {
+        auto id = vs_id + "+" + fs_id;
+
+        auto it = id_to_shader_pipelines.find(id);
+        if (it != id_to_shader_pipelines.end()) {
+            return it->second;
+        }
+
+        auto& vertex_stage = shader_stage(GL_VERTEX_SHADER, vs_id);
+        auto& fragment_stage = shader_stage(GL_FRAGMENT_SHADER, fs_id);
+        return id_to_shader_pipelines
+            .insert({id, Shader::pipeline(vertex_stage, fragment_stage)})
+            .first->second;
+    }
+
+    void precompile_shader(const string& vs_id, const string& fs_id,
+                           Store& store) {
+        shader(vs_id, fs_id, {}, store).compile_async();
+    }
+
+    // NOTE(panmar): Rebuilds the programs whose files, or files they include,
+    // changed on disk; programs whose expanded source stayed the same are
+    // kept. Returns the number of rebuilt programs.
+    u32 reload_changed_shaders() {
+        auto changed = shader_preprocessor.invalidate_changed();
+        u32 reloaded = 0;
+        for (auto& [id, shader] : id_to_shaders) {
+            reloaded += shader.reload_if_changed(changed);
+        }
+        for (auto& [id, stage] : id_to_shader_stages) {
+            reloaded += stage.reload_if_changed(changed);
+        }
+        for (auto& [id, variants] : id_to_shader_variants) {
+            reloaded += variants.reload_if_changed(changed);
+        }
+        return reloaded;
+    }
+
+    // NOTE(panmar): One sampler object per distinct desc, shared by all users
+    const Sampler& sampler(const SamplerDesc& desc) {
+        auto key = desc.key();
+        auto it = key_to_samplers.find(key);
+        if (it == key_to_samplers.end()) {
+            it = key_to_samplers.insert({key, Sampler::from_desc(desc)}).first;
+        }
+        return it->second;
+    }
 
     Texture& texture(const string& id) {
         auto it = id_to_textures.find(id);
@@ -97,9 +207,40 @@ public:
     }
 
 private:
+    Path resource_path(const string& id) const {
+        auto path_it =
+            std::find_if(resource_filepaths.begin(), resource_filepaths.end(),
+                         [&id](const std::filesystem::path& p) {
+                             return id == p.filename();
+                         });
+
+        if (path_it == resource_filepaths.end()) {
+            string error = fmt::format("Cannot find resource {}", id);
+            throw PlayGlException(error);
+        }
+        return *path_it;
+    }
+
+    Shader& shader_stage(u32 stage, const string& id) {
+        auto it = id_to_shader_stages.find(id);
+        if (it != id_to_shader_stages.end()) {
+            return it->second;
+        }
+
+        auto shader = Shader::stage_from_file(stage, resource_path(id),
+                                              &shader_preprocessor);
+        return id_to_shader_stages.insert({id, std::move(shader)})
+            .first->second;
+    }
+
     vector<std::filesystem::path> resource_filepaths;
+    ShaderPreprocessor shader_preprocessor;
 
     unordered_map<string, Model> id_to_models;
     unordered_map<string, Shader> id_to_shaders;
+    unordered_map<string, ShaderVariants> id_to_shader_variants;
+    unordered_map<string, Shader> id_to_shader_stages;
+    unordered_map<string, Shader> id_to_shader_pipelines;
     unordered_map<string, Texture> id_to_textures;
+    unordered_map<u64, Sampler> key_to_samplers;
 };
@@ -58,7 +58,10 @@ public:
                   Framebuffer& debug_layer)
         : content(content),
           geometry_renderer(renderer),
-          debug_layer(debug_layer) {}
+          debug_layer(debug_layer),
+          grid_geometry(renderer.add(geometry::Grid{})),
+          gizmo_geometry(renderer.add(geometry::Gizmo{})),
+          screen_quad(renderer.add(geometry::ScreenQuad{})) {}
 
     void clear() {
         debug_layer.color().depth().clear(Color(1.f, 1.f, 1.f, 0.f));
@@ -78,10 +81,8 @@ public:
             throw PlayGlException("Too many debug textures.");
         }
 
-        auto active_framebuffer = 0;
-        glGetIntegerv(GL_FRAMEBUFFER_BINDING, &active_framebuffer);
-        i32 viewport_desc[4] = {0};
-        glGetIntegerv(GL_VIEWPORT, viewport_desc);
+        auto active_framebuffer = GpuStateCache::framebuffer();
+        auto viewport_desc = GpuStateCache::viewport();
 
         {
             debug_layer.bind();
@@ -90,8 +91,9 @@ public:
                           MAX_DEBUG_TEXTURES;
             auto width = height * texture.desc.aspect_ratio();
 
-            geometry_renderer(geometry::ScreenQuad())
-                .shader("postprocess.vs", "postprocess.fs")
+            geometry_renderer(screen_quad)
+                .shader(content.shader_pipeline("postprocess.vs",
+                                                "postprocess.fs"))
                 .param("transform",
                        create_transform(
                            0, height * debug_textures_drawn, width, height,
@@ -103,7 +105,7 @@ public:
 
         ++debug_textures_drawn;
 
-        glBindFramebuffer(GL_FRAMEBUFFER, active_framebuffer);
+        GpuStateCache::glBindFramebuffer(active_framebuffer);
         GpuStateCache::glViewport(viewport_desc[0], viewport_desc[1],
                                   viewport_desc[2], viewport_desc[3]);
     }
@@ -141,8 +143,10 @@ public:
         render_grids(camera);
         render_gizmos(camera);
         render_models(camera);
+        release_unused_models();
 
         render_to_camera(camera);
+        ++frame;
     }
 
 private:
@@ -150,6 +154,20 @@ private:
     GeometryRenderer& geometry_renderer;
     Framebuffer& debug_layer;
 
+    GeometryHandle grid_geometry;
+    GeometryHandle gizmo_geometry;
+    GeometryHandle screen_quad;
+
+    // NOTE(panmar): Model geometry is registered on first draw and released
+    // once the model has not been drawn for MODEL_GEOMETRY_TTL_FRAMES
+    struct ModelGeometry {
+        vector<GeometryHandle> parts;
+        u64 last_used_frame = 0;
+    };
+    unordered_map<string, ModelGeometry> model_geometries;
+    u64 frame = 0;
+    static constexpr u64 MODEL_GEOMETRY_TTL_FRAMES = 120;
+
     mutable vector<GridDesc> grids;
     mutable vector<GizmoDesc> gizmos;
     mutable vector<ModelDesc> models;
@@ -159,7 +177,7 @@ private:
 
     void render_grids(const Camera& camera) {
         for (auto& grid : grids) {
-            geometry_renderer(geometry::Grid{})
+            geometry_renderer(grid_geometry)
                 .shader("debug_dash.vs", "debug_dash.fs")
                 .param("world", glm::translate(grid._position) *
                                     glm::scale(vec3(grid._edge / 2.f)))
@@ -176,7 +194,7 @@ private:
 
     void render_gizmos(const Camera& camera) {
         for (auto& gizmo : gizmos) {
-            geometry_renderer(geometry::Gizmo{})
+            geometry_renderer(gizmo_geometry)
                 .shader("debug_dash.vs", "debug_dash.fs")
                 .param("world", gizmo._transform *
                                     glm::translate(gizmo._position) *
@@ -196,11 +214,13 @@ private:
         for (auto& model_desc : models) {
             auto gpu_state = GpuState().wireframe().nodepth();
 
-            auto model = content.model(model_desc.model_id).resource();
-            for (auto& part : model.parts) {
-                geometry_renderer(part.geometry)
-                    .shader("solid_color.vs", "solid_color.fs")
-                    .param("world", part.transform)
+            auto& model = content.model(model_desc.model_id).resource();
+            auto& part_geometries = register_model(model_desc.model_id, model);
+            for (size_t i = 0; i < model.parts.size(); ++i) {
+                auto& part = model.parts[i];
+                geometry_renderer(part_geometries[i])
+                    .shader("solid_color_batched.vs", "solid_color.fs")
+                    .batched(part.transform)
                     .param("view", camera.geometry.get_view())
                     .param("projection", camera.geometry.get_projection())
                     .param("color", Colors::Green)
@@ -210,10 +230,42 @@ private:
         }
     }
 
+    const vector<GeometryHandle>& register_model(const string& model_id,
+                                                 const ModelData& model) {
+        auto it = model_geometries.find(model_id);
+        if (it == model_geometries.end()) {
+            ModelGeometry model_geometry;
+            for (auto& part : model.parts) {
+                model_geometry.parts.push_back(
+                    geometry_renderer.add(part.geometry));
+            }
+            it = model_geometries.insert({model_id, std::move(model_geometry)})
+                     .first;
+        }
+        it->second.last_used_frame = frame;
+        return it->second.parts;
+    }
+
+    void release_unused_models() {
+        for (auto it = model_geometries.begin();
+             it != model_geometries.end();) {
+            auto unused_frames = frame - it->second.last_used_frame;
+            if (unused_frames < MODEL_GEOMETRY_TTL_FRAMES) {
+                ++it;
+                continue;
+            }
+            for (auto& handle : it->second.parts) {
+                geometry_renderer.remove(handle);
+            }
+            it = model_geometries.erase(it);
+        }
+    }
+
     void render_to_camera(const Camera& camera) {
         camera.canvas.framebuffer.bind();
-        geometry_renderer(geometry::ScreenQuad())
-            .shader("postprocess.vs", "postprocess.fs")
+        geometry_renderer(screen_quad)
+            .shader(
+                content.shader_pipeline("postprocess.vs", "postprocess.fs"))
             .param("transform", mat4(1.f))
             .param("tex0", debug_layer.color_texture.value())
             .state(GpuState().nodepth().blend(
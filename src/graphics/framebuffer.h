@@ -39,15 +39,15 @@ public:
         return *this;
     }
 
+    // NOTE(panmar): Leaves the default framebuffer bound, for what is drawn
+    // on top of the presented image
     Framebuffer& present() {
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
-        glBindFramebuffer(GL_READ_FRAMEBUFFER, resource());
-        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
-        glBlitFramebuffer(0, 0, color_texture.value().desc.width,
-                          color_texture.value().desc.height, 0, 0,
-                          config::window_width, config::window_height,
-                          GL_COLOR_BUFFER_BIT, GL_LINEAR);
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glBlitNamedFramebuffer(resource(), 0, 0, 0,
+                               color_texture.value().desc.width,
+                               color_texture.value().desc.height, 0, 0,
+                               config::window_width, config::window_height,
+                               GL_COLOR_BUFFER_BIT, GL_LINEAR);
+        GpuStateCache::glBindFramebuffer(0);
         return *this;
     }
 
@@ -63,12 +63,10 @@ public:
 
         color_texture.emplace(Texture::from_desc(
             TextureDesc{width, height, TextureDesc::Format::RGBA32F}));
-        glBindFramebuffer(GL_FRAMEBUFFER, resource());
-        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
-                               GL_TEXTURE_2D, color_texture.value().resource(),
-                               0);
+        glNamedFramebufferTexture(resource(), GL_COLOR_ATTACHMENT0,
+                                  color_texture.value().resource(), 0);
 
-        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) !=
+        if (glCheckNamedFramebufferStatus(resource(), GL_FRAMEBUFFER) !=
             GL_FRAMEBUFFER_COMPLETE) {
             PlayGlException("Framebuffer is not complete!");
         }
@@ -77,8 +75,6 @@ public:
         debug::label(fmt::format("{}_color", label), GL_TEXTURE,
                      color_texture.value().resource());
 
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
-
         return *this;
     }
 
@@ -94,12 +90,10 @@ public:
 
         depth_texture.emplace(Texture::from_desc(
             TextureDesc{width, height, TextureDesc::Format::Depth32}));
-        glBindFramebuffer(GL_FRAMEBUFFER, resource());
-        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
-                               GL_TEXTURE_2D, depth_texture.value().resource(),
-                               0);
+        glNamedFramebufferTexture(resource(), GL_DEPTH_ATTACHMENT,
+                                  depth_texture.value().resource(), 0);
 
-        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) !=
+        if (glCheckNamedFramebufferStatus(resource(), GL_FRAMEBUFFER) !=
             GL_FRAMEBUFFER_COMPLETE) {
             PlayGlException("Framebuffer is not complete!");
         }
@@ -108,19 +102,18 @@ public:
         debug::label(fmt::format("{}_depth", label), GL_TEXTURE,
                      depth_texture.value().resource());
 
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
         return *this;
     }
 
     void bind() const {
         if (resource()) {
-            glBindFramebuffer(GL_FRAMEBUFFER, resource());
+            GpuStateCache::glBindFramebuffer(resource());
             GpuStateCache::glViewport(0, 0, color_texture.value().desc.width,
                                       color_texture.value().desc.height);
         }
     }
 
-    void unbind() const { glBindFramebuffer(GL_FRAMEBUFFER, 0); }
+    void unbind() const { GpuStateCache::glBindFramebuffer(0); }
 
     optional<Texture> color_texture;
     optional<Texture> depth_texture;
@@ -128,7 +121,7 @@ public:
 private:
     virtual u32 create_resource() const override {
         auto result = 0U;
-        glGenFramebuffers(1, &result);
+        glCreateFramebuffers(1, &result);
         return result;
     }
 
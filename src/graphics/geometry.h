@@ -18,10 +18,165 @@ struct Geometry {
     vector<vec2> texcoords;
     vector<u32> indices;
     Topology topology = Topology::Triangles;
+
+    // NOTE(panmar): Opts into compressed vertex attributes on upload, see
+    // vertex_quantization.h; requires shaders that decode them
+    bool quantized = false;
 };
 
 namespace geometry {
 
+// NOTE(panmar): Simulated vertex shader invocations of an indexed draw with a
+// FIFO post-transform cache. A vertex is in the cache if fewer than
+// `cache_size` vertices were loaded since it was loaded itself.
+inline u32 count_cache_misses(const vector<u32>& indices, u32 vertex_count,
+                              u32 cache_size = 16) {
+    vector<u32> load_times(vertex_count, 0);
+    u32 time = cache_size + 1;
+    u32 misses = 0;
+    for (auto index : indices) {
+        if (time - load_times[index] > cache_size) {
+            load_times[index] = time++;
+            ++misses;
+        }
+    }
+    return misses;
+}
+
+struct WeldDesc {
+    // NOTE(panmar): Vertices closer than the tolerances are merged; normals
+    // further apart than the angle are kept separate, so hard edges stay hard
+    f32 position_tolerance = 1e-5f;
+    f32 normal_angle_degrees = 1.f;
+    f32 texcoord_tolerance = 1e-5f;
+};
+
+struct WeldReport {
+    u32 vertices_before = 0;
+    u32 vertices_after = 0;
+    // NOTE(panmar): Vertex shader invocations, see count_cache_misses
+    u32 invocations_before = 0;
+    u32 invocations_after = 0;
+};
+
+// NOTE(panmar): Merges duplicate vertices found through a hash grid with
+// cells of the position tolerance; always produces an indexed mesh. The cache
+// simulation behind the report only runs when one is passed in.
+inline void weld(Geometry& geometry, const WeldDesc& desc = {},
+                 WeldReport* report = nullptr) {
+    auto vertex_count = static_cast<u32>(geometry.positions.size());
+    if (report) {
+        report->vertices_before = vertex_count;
+        // NOTE(panmar): Non-indexed draws never hit the post-transform cache
+        report->invocations_before =
+            geometry.indices.empty()
+                ? vertex_count
+                : count_cache_misses(geometry.indices, vertex_count);
+    }
+
+    if (geometry.indices.empty()) {
+        geometry.indices.resize(vertex_count);
+        std::iota(geometry.indices.begin(), geometry.indices.end(), 0);
+    }
+
+    auto has_normals = !geometry.normals.empty();
+    auto has_texcoords = !geometry.texcoords.empty();
+    auto cell_size = std::max(desc.position_tolerance, 1e-12f);
+    auto min_normal_cosine =
+        std::cos(glm::radians(desc.normal_angle_degrees));
+
+    auto cell_of = [cell_size](const vec3& position) {
+        return glm::ivec3(glm::floor(position / cell_size));
+    };
+    auto cell_key = [](const glm::ivec3& cell) {
+        return static_cast<u64>(static_cast<u32>(cell.x)) * 73856093ull ^
+               static_cast<u64>(static_cast<u32>(cell.y)) * 19349663ull ^
+               static_cast<u64>(static_cast<u32>(cell.z)) * 83492791ull;
+    };
+
+    Geometry welded;
+    welded.positions.reserve(vertex_count);
+    welded.normals.reserve(has_normals ? vertex_count : 0);
+    welded.texcoords.reserve(has_texcoords ? vertex_count : 0);
+
+    auto equal = [&](u32 vertex, u32 welded_vertex) {
+        auto& position = geometry.positions[vertex];
+        auto& welded_position = welded.positions[welded_vertex];
+        if (glm::any(glm::greaterThan(glm::abs(position - welded_position),
+                                      vec3(desc.position_tolerance)))) {
+            return false;
+        }
+        // NOTE(panmar): Written so degenerate (NaN) normals never match
+        if (has_normals &&
+            !(glm::dot(glm::normalize(geometry.normals[vertex]),
+                       glm::normalize(welded.normals[welded_vertex])) >=
+              min_normal_cosine)) {
+            return false;
+        }
+        if (has_texcoords &&
+            glm::any(glm::greaterThan(
+                glm::abs(geometry.texcoords[vertex] -
+                         welded.texcoords[welded_vertex]),
+                vec2(desc.texcoord_tolerance)))) {
+            return false;
+        }
+        return true;
+    };
+
+    unordered_map<u64, vector<u32>> grid;
+    vector<u32> remap(vertex_count);
+    for (u32 v = 0; v < vertex_count; ++v) {
+        auto cell = cell_of(geometry.positions[v]);
+
+        // NOTE(panmar): A vertex within tolerance may sit in a neighbour cell
+        optional<u32> match;
+        for (i32 z = -1; z <= 1 && !match; ++z) {
+            for (i32 y = -1; y <= 1 && !match; ++y) {
+                for (i32 x = -1; x <= 1 && !match; ++x) {
+                    auto it = grid.find(cell_key(cell + glm::ivec3(x, y, z)));
+                    if (it == grid.end()) {
+                        continue;
+                    }
+                    for (auto candidate : it->second) {
+                        if (equal(v, candidate)) {
+                            match = candidate;
+                            break;
+                        }
+                    }
+                }
+            }
+        }
+
+        if (match) {
+            remap[v] = *match;
+            continue;
+        }
+
+        remap[v] = static_cast<u32>(welded.positions.size());
+        grid[cell_key(cell)].push_back(remap[v]);
+        welded.positions.push_back(geometry.positions[v]);
+        if (has_normals) {
+            welded.normals.push_back(geometry.normals[v]);
+        }
+        if (has_texcoords) {
+            welded.texcoords.push_back(geometry.texcoords[v]);
+        }
+    }
+
+    for (auto& index : geometry.indices) {
+        index = remap[index];
+    }
+    geometry.positions = std::move(welded.positions);
+    geometry.normals = std::move(welded.normals);
+    geometry.texcoords = std::move(welded.texcoords);
+
+    if (report) {
+        report->vertices_after = static_cast<u32>(geometry.positions.size());
+        report->invocations_after =
+            count_cache_misses(geometry.indices, report->vertices_after);
+    }
+}
+
 struct Grid : public Geometry {
     Grid() {
         topology = Topology::Lines;
@@ -239,144 +394,137 @@ struct WirePyramid : public Geometry {
     }
 };
 
+inline void copy_mesh(Geometry& geometry, const par_shapes_mesh* mesh) {
+    auto points = reinterpret_cast<const vec3*>(mesh->points);
+    geometry.positions.assign(points, points + mesh->npoints);
+
+    if (mesh->normals) {
+        auto normals = reinterpret_cast<const vec3*>(mesh->normals);
+        geometry.normals.assign(normals, normals + mesh->npoints);
+    }
+
+    if (mesh->tcoords) {
+        auto tcoords = reinterpret_cast<const vec2*>(mesh->tcoords);
+        geometry.texcoords.assign(tcoords, tcoords + mesh->npoints);
+    }
+
+    geometry.indices.assign(mesh->triangles,
+                            mesh->triangles + mesh->ntriangles * 3);
+}
+
 struct PlatonicSolidParShapes : public Geometry {
     using MeshGenerator = par_shapes_mesh* (*)();
 
-    PlatonicSolidParShapes(MeshGenerator generator) {
+    PlatonicSolidParShapes(MeshGenerator generator,
+                           WeldReport* weld_report = nullptr) {
         topology = Topology::Triangles;
 
+        // NOTE(panmar): Unwelded for flat face normals, then welded back
+        // within each face, so only the vertices on hard edges stay split
         par_shapes_mesh* mesh = generator();
         par_shapes_unweld(mesh, true);
         par_shapes_compute_normals(mesh);
 
-        for (auto i = 0; i < mesh->npoints; ++i) {
-            positions.push_back({mesh->points[3 * i], mesh->points[3 * i + 1],
-                                 mesh->points[3 * i + 2]});
-        }
-
-        if (mesh->normals) {
-            for (auto i = 0; i < mesh->npoints; ++i) {
-                normals.push_back({mesh->normals[3 * i],
-                                   mesh->normals[3 * i + 1],
-                                   mesh->normals[3 * i + 2]});
-            }
-        }
-
-        auto mesh_index_count = mesh->ntriangles * 3;
-        for (auto i = 0; i < mesh_index_count; ++i) {
-            u32 index = mesh->triangles[i];
-            indices.push_back(index);
-        }
-
+        copy_mesh(*this, mesh);
         par_shapes_free_mesh(mesh);
+
+        weld(*this, {}, weld_report);
     }
 };
 
 struct Dodecahedron : public PlatonicSolidParShapes {
-    Dodecahedron() : PlatonicSolidParShapes(par_shapes_create_dodecahedron) {}
+    Dodecahedron(WeldReport* weld_report = nullptr)
+        : PlatonicSolidParShapes(par_shapes_create_dodecahedron, weld_report) {}
 };
 
 struct Tetrahedron : public PlatonicSolidParShapes {
-    Tetrahedron() : PlatonicSolidParShapes(par_shapes_create_tetrahedron) {}
+    Tetrahedron(WeldReport* weld_report = nullptr)
+        : PlatonicSolidParShapes(par_shapes_create_tetrahedron, weld_report) {}
 };
 
 struct Octahedron : public PlatonicSolidParShapes {
-    Octahedron() : PlatonicSolidParShapes(par_shapes_create_octahedron) {}
+    Octahedron(WeldReport* weld_report = nullptr)
+        : PlatonicSolidParShapes(par_shapes_create_octahedron, weld_report) {}
 };
 
 struct Isohedron : public PlatonicSolidParShapes {
-    Isohedron() : PlatonicSolidParShapes(par_shapes_create_icosahedron) {}
+    Isohedron(WeldReport* weld_report = nullptr)
+        : PlatonicSolidParShapes(par_shapes_create_icosahedron, weld_report) {}
 };
 
 struct ParametricSurfaceParShapes : public Geometry {
     template <class MeshGeneratorType, class... Args>
-    ParametricSurfaceParShapes(MeshGeneratorType generator, Args... args) {
+    ParametricSurfaceParShapes(WeldReport* weld_report,
+                               MeshGeneratorType generator, Args... args) {
         topology = Topology::Triangles;
 
         par_shapes_mesh* mesh = generator(args...);
-
-        for (auto i = 0; i < mesh->npoints; ++i) {
-            positions.push_back({mesh->points[3 * i], mesh->points[3 * i + 1],
-                                 mesh->points[3 * i + 2]});
-        }
-
-        if (mesh->normals) {
-            for (auto i = 0; i < mesh->npoints; ++i) {
-                normals.push_back({mesh->normals[3 * i],
-                                   mesh->normals[3 * i + 1],
-                                   mesh->normals[3 * i + 2]});
-            }
-        }
-
-        if (mesh->tcoords) {
-            for (auto i = 0; i < mesh->npoints; ++i) {
-                texcoords.push_back(
-                    {mesh->tcoords[2 * i], mesh->tcoords[2 * i + 1]});
-            }
-        }
-
-        auto mesh_index_count = mesh->ntriangles * 3;
-        for (auto i = 0; i < mesh_index_count; ++i) {
-            u32 index = mesh->triangles[i];
-            indices.push_back(index);
-        }
-
+        copy_mesh(*this, mesh);
         par_shapes_free_mesh(mesh);
+
+        // NOTE(panmar): Parametric surfaces duplicate vertices along seams
+        // and at poles; attribute-aware welding keeps the texcoord seams
+        weld(*this, {}, weld_report);
     }
 };
 
 template <u32 slices = 30, u32 stacks = 3>
 struct OpenCylinder : public ParametricSurfaceParShapes {
-    OpenCylinder()
-        : ParametricSurfaceParShapes(par_shapes_create_cylinder, slices,
-                                     stacks) {}
+    OpenCylinder(WeldReport* weld_report = nullptr)
+        : ParametricSurfaceParShapes(weld_report, par_shapes_create_cylinder,
+                                     slices, stacks) {}
 };
 
 template <u32 slices = 1, u32 stacks = 30>
 struct CylinderDisk : public ParametricSurfaceParShapes {
-    CylinderDisk(const vec3& center = {0, 1, 3}, const vec3& normal = {0, 1, 0})
-        : ParametricSurfaceParShapes(par_shapes_create_disk, slices, stacks,
-                                     &center.x, &normal.x) {}
+    CylinderDisk(const vec3& center = {0, 1, 3}, const vec3& normal = {0, 1, 0},
+                 WeldReport* weld_report = nullptr)
+        : ParametricSurfaceParShapes(weld_report, par_shapes_create_disk,
+                                     slices, stacks, &center.x, &normal.x) {}
 };
 
 template <u32 slices = 10, u32 stacks = 10>
 struct Hemisphere : public ParametricSurfaceParShapes {
-    Hemisphere()
-        : ParametricSurfaceParShapes(par_shapes_create_hemisphere, slices,
-                                     stacks) {}
+    Hemisphere(WeldReport* weld_report = nullptr)
+        : ParametricSurfaceParShapes(weld_report, par_shapes_create_hemisphere,
+                                     slices, stacks) {}
 };
 
 template <u32 slices = 3, u32 stacks = 3>
 struct Plane : public ParametricSurfaceParShapes {
-    Plane()
-        : ParametricSurfaceParShapes(par_shapes_create_plane, slices, stacks) {}
+    Plane(WeldReport* weld_report = nullptr)
+        : ParametricSurfaceParShapes(weld_report, par_shapes_create_plane,
+                                     slices, stacks) {}
 };
 
 template <u32 slices = 30, u32 stacks = 40>
 struct Torus : public ParametricSurfaceParShapes {
-    Torus(f32 radius = 1.f)
-        : ParametricSurfaceParShapes(par_shapes_create_torus, slices, stacks,
-                                     radius) {}
+    Torus(f32 radius = 1.f, WeldReport* weld_report = nullptr)
+        : ParametricSurfaceParShapes(weld_report, par_shapes_create_torus,
+                                     slices, stacks, radius) {}
 };
 
 template <u32 slices = 15, u32 stacks = 15>
 struct Sphere : public ParametricSurfaceParShapes {
-    Sphere()
-        : ParametricSurfaceParShapes(par_shapes_create_parametric_sphere,
+    Sphere(WeldReport* weld_report = nullptr)
+        : ParametricSurfaceParShapes(weld_report,
+                                     par_shapes_create_parametric_sphere,
                                      slices, stacks) {}
 };
 
 template <u32 subdivisions = 1>
 struct SubdividedSphere : public ParametricSurfaceParShapes {
-    SubdividedSphere()
-        : ParametricSurfaceParShapes(par_shapes_create_subdivided_sphere,
+    SubdividedSphere(WeldReport* weld_report = nullptr)
+        : ParametricSurfaceParShapes(weld_report,
+                                     par_shapes_create_subdivided_sphere,
                                      subdivisions) {}
 };
 
 template <u32 slices = 30, u32 stacks = 40>
 struct TrefoilKnot : public ParametricSurfaceParShapes {
-    TrefoilKnot(f32 radius = 1.f)
-        : ParametricSurfaceParShapes(par_shapes_create_trefoil_knot, slices,
+    TrefoilKnot(f32 radius = 1.f, WeldReport* weld_report = nullptr)
+        : ParametricSurfaceParShapes(weld_report,
+                                     par_shapes_create_trefoil_knot, slices,
                                      stacks, radius) {}
 };
 
@@ -7,207 +7,846 @@
 #include "meow_hash.h"
 
 #include "common.h"
+#include "config.h"
 #include "graphics/geometry.h"
+#include "graphics/render_queue.h"
 #include "graphics/state.h"
 #include "graphics/shader.h"
+#include "graphics/stream_buffer.h"
+#include "graphics/vertex_pool.h"
+#include "graphics/vertex_quantization.h"
 #include "store.h"
 
+// NOTE(panmar): Geometry registered in the GeometryRenderer is identified by a
+// stable id. The generation is bumped on every update, so gpu buffers cached
+// for the id know when they need to be re-uploaded. Only the handle passed to
+// update is refreshed; other copies of it are stale and throw when used, so
+// re-fetch them from the owner after an update.
+struct GeometryHandle {
+    u32 id = 0;
+    u32 generation = 0;
+};
+
+// NOTE(panmar): Interleaved keeps all attributes of a vertex next to each
+// other in a single buffer; Separate uses one buffer per attribute
+enum class VertexLayout { Interleaved, Separate };
+
+struct VertexFormat {
+    struct Attrib {
+        u32 location = 0;
+        i32 components = 0;
+        u32 size = 0;
+        u32 offset = 0;
+        u32 type = GL_FLOAT;
+        bool normalized = false;
+    };
+
+    bool normals = false;
+    bool texcoords = false;
+    VertexLayout layout = VertexLayout::Interleaved;
+
+    // NOTE(panmar): Compressed attributes, see vertex_quantization.h; only
+    // available with the interleaved layout
+    bool quantized = false;
+    bool quantized_texcoords = false;
+
+    // NOTE(panmar): Per-instance attributes; each is streamed from its own
+    // binding, whose index is the location of the attribute
+    bool instance_world = false;
+    bool instance_color = false;
+    u32 instance_data_mask = 0;
+
+    static VertexFormat from(const Geometry& geometry, VertexLayout layout) {
+        auto format = VertexFormat{!geometry.normals.empty(),
+                                   !geometry.texcoords.empty(), layout};
+        if (geometry.quantized && layout == VertexLayout::Interleaved) {
+            format.quantized = true;
+            format.quantized_texcoords =
+                format.texcoords &&
+                quantization::texcoords_quantizable(geometry.texcoords);
+        }
+        return format;
+    }
+
+    vector<Attrib> attribs() const {
+        vector<Attrib> result;
+        if (quantized) {
+            result.push_back({Shader::INPUT_POSITION_LOCATION, 4, sizeof(u64),
+                              0, GL_HALF_FLOAT});
+        } else {
+            result.push_back(
+                {Shader::INPUT_POSITION_LOCATION, 3, sizeof(vec3)});
+        }
+
+        if (normals && quantized) {
+            result.push_back({Shader::INPUT_NORMAL_LOCATION, 2, sizeof(u32), 0,
+                              GL_SHORT, true});
+        } else if (normals) {
+            result.push_back({Shader::INPUT_NORMAL_LOCATION, 3, sizeof(vec3)});
+        }
+
+        if (texcoords && quantized_texcoords) {
+            result.push_back({Shader::INPUT_TEXCOORD_LOCATION, 2, sizeof(u32),
+                              0, GL_UNSIGNED_SHORT, true});
+        } else if (texcoords) {
+            result.push_back(
+                {Shader::INPUT_TEXCOORD_LOCATION, 2, sizeof(vec2)});
+        }
+
+        if (layout == VertexLayout::Interleaved) {
+            u32 offset = 0;
+            for (auto& attrib : result) {
+                attrib.offset = offset;
+                offset += attrib.size;
+            }
+        }
+
+        return result;
+    }
+
+    u32 stride() const {
+        u32 result = 0;
+        for (auto& attrib : attribs()) {
+            result += attrib.size;
+        }
+        return result;
+    }
+
+    u32 binding(const Attrib& attrib) const {
+        return layout == VertexLayout::Interleaved ? 0 : attrib.location;
+    }
+
+    u32 key() const {
+        return static_cast<u32>(normals) | (static_cast<u32>(texcoords) << 1) |
+               (static_cast<u32>(layout) << 2) |
+               (static_cast<u32>(instance_world) << 3) |
+               (static_cast<u32>(instance_color) << 4) |
+               (instance_data_mask << 5) |
+               (static_cast<u32>(quantized) << 9) |
+               (static_cast<u32>(quantized_texcoords) << 10);
+    }
+};
+
+// NOTE(panmar): A single vao per vertex format; gpu buffers only attach their
+// vertex/index buffers to it when bound
+class VertexArrayCache {
+public:
+    VertexArrayCache() = default;
+    VertexArrayCache(const VertexArrayCache&) = delete;
+    VertexArrayCache& operator=(const VertexArrayCache&) = delete;
+
+    ~VertexArrayCache() {
+        for (auto& key_value : format_to_vaos) {
+            glDeleteVertexArrays(1, &key_value.second);
+        }
+    }
+
+    u32 get(const VertexFormat& format) {
+        auto it = format_to_vaos.find(format.key());
+        if (it != format_to_vaos.end()) {
+            return it->second;
+        }
+
+        // NOTE(panmar): Set up with direct state access, so the vao bound by
+        // the render queue is left alone
+        u32 vao = 0;
+        glCreateVertexArrays(1, &vao);
+
+        for (auto& attrib : format.attribs()) {
+            glEnableVertexArrayAttrib(vao, attrib.location);
+            glVertexArrayAttribFormat(vao, attrib.location, attrib.components,
+                                      attrib.type, attrib.normalized,
+                                      attrib.offset);
+            glVertexArrayAttribBinding(vao, attrib.location,
+                                       format.binding(attrib));
+        }
+
+        if (format.instance_world) {
+            for (u32 column = 0; column < 4; ++column) {
+                setup_instance_attrib(
+                    vao, Shader::INPUT_INSTANCE_WORLD_LOCATION + column,
+                    Shader::INPUT_INSTANCE_WORLD_LOCATION,
+                    column * sizeof(vec4));
+            }
+        }
+
+        if (format.instance_color) {
+            setup_instance_attrib(vao, Shader::INPUT_INSTANCE_COLOR_LOCATION,
+                                  Shader::INPUT_INSTANCE_COLOR_LOCATION, 0);
+        }
+
+        for (u32 slot = 0; slot < Shader::MAX_INSTANCE_DATA; ++slot) {
+            if (format.instance_data_mask & (1 << slot)) {
+                auto location = Shader::INPUT_INSTANCE_DATA_LOCATION + slot;
+                setup_instance_attrib(vao, location, location, 0);
+            }
+        }
+
+        debug::label(fmt::format("vertex_format_{}", format.key()),
+                     GL_VERTEX_ARRAY, vao);
+
+        return format_to_vaos.insert({format.key(), vao}).first->second;
+    }
+
+private:
+    static void setup_instance_attrib(u32 vao, u32 location, u32 binding,
+                                      u32 offset) {
+        glEnableVertexArrayAttrib(vao, location);
+        glVertexArrayAttribFormat(vao, location, 4, GL_FLOAT, false, offset);
+        glVertexArrayAttribBinding(vao, location, binding);
+        glVertexArrayBindingDivisor(vao, binding, 1);
+    }
+
+    unordered_map<u32, u32> format_to_vaos;
+};
+
 struct GpuBuffer {
     GpuBuffer() = default;
 
-    GpuBuffer(GpuBuffer&& other) : vao(other.vao), vbo(other.vbo) {
-        other.vao = other.vbo = 0;
+    GpuBuffer(GpuBuffer&& other)
+        : format(other.format),
+          vao(other.vao),
+          vertex_bindings(std::move(other.vertex_bindings)),
+          ebo(other.ebo),
+          index_offset(other.index_offset),
+          index_type(other.index_type),
+          base_vertex(other.base_vertex),
+          quantization(other.quantization),
+          owning(other.owning),
+          pool(other.pool),
+          pool_allocation(other.pool_allocation) {
+        other.vao = other.ebo = other.index_offset = 0;
+        other.base_vertex = 0;
+        other.vertex_bindings.clear();
+        other.pool = nullptr;
     }
 
-    static GpuBuffer from(const Geometry& geometry, const Shader& shader) {
+    GpuBuffer(const GpuBuffer&) = delete;
+    GpuBuffer& operator=(const GpuBuffer&) = delete;
+    GpuBuffer& operator=(GpuBuffer&&) = delete;
+
+    static GpuBuffer from(const Geometry& geometry, VertexLayout layout,
+                          VertexArrayCache& vertex_arrays) {
+        validate(geometry);
+
         auto buffer = GpuBuffer{};
+        auto format = VertexFormat::from(geometry, layout);
+        buffer.format = format;
+        buffer.vao = vertex_arrays.get(format);
 
-        if (!shader.has_attrib(Shader::INPUT_POSITION_ATTRIB)) {
-            throw PlayGlException(
-                fmt::format("Attrib {} does not exist in the shader.",
-                            Shader::INPUT_POSITION_ATTRIB));
+        if (layout == VertexLayout::Interleaved) {
+            auto data = vector<u8>(format.stride() * geometry.positions.size());
+            buffer.quantization = interleave(geometry, format, data.data());
+            buffer.vertex_bindings.push_back(
+                {0, upload(data), format.stride()});
+        } else {
+            for (auto& attrib : format.attribs()) {
+                auto vbo = 0U;
+                if (attrib.location == Shader::INPUT_POSITION_LOCATION) {
+                    vbo = upload(geometry.positions);
+                } else if (attrib.location == Shader::INPUT_NORMAL_LOCATION) {
+                    vbo = upload(geometry.normals);
+                } else if (attrib.location ==
+                           Shader::INPUT_TEXCOORD_LOCATION) {
+                    vbo = upload(geometry.texcoords);
+                }
+                buffer.vertex_bindings.push_back(
+                    {format.binding(attrib), vbo, attrib.size});
+            }
         }
 
-        if (geometry.positions.empty()) {
-            throw PlayGlException("Geometry has no positions.");
+        if (!geometry.indices.empty()) {
+            buffer.index_type = index_type_for(geometry);
+            buffer.ebo = upload(narrow_indices(geometry, buffer.index_type));
+        }
+
+        return buffer;
+    }
+
+    // NOTE(panmar): Writes the geometry straight into the mapped stream
+    // buffer; the result does not own any gl buffer and is valid only for
+    // the current frame. Returns nullopt if the frame region is full.
+    static optional<GpuBuffer> from_stream(const Geometry& geometry,
+                                           StreamBuffer& stream,
+                                           VertexArrayCache& vertex_arrays) {
+        validate(geometry);
+
+        auto format = VertexFormat::from(geometry, VertexLayout::Interleaved);
+        auto stride = format.stride();
+        auto vertices_size = stride * geometry.positions.size();
+        auto index_type = index_type_for(geometry);
+        auto index_size = index_type_size(index_type);
+        auto indices_size = index_size * geometry.indices.size();
+
+        if (vertices_size + indices_size + 32 > stream.capacity()) {
+            return std::nullopt;
         }
 
-        glGenVertexArrays(1, &buffer.vao);
-        glBindVertexArray(buffer.vao);
+        auto vertices = stream.allocate(vertices_size, stride);
+        if (!vertices) {
+            return std::nullopt;
+        }
+
+        auto buffer = GpuBuffer{};
+        buffer.owning = false;
+        buffer.format = format;
+        buffer.vao = vertex_arrays.get(format);
+        buffer.quantization = interleave(geometry, format, vertices->data);
+        buffer.vertex_bindings.push_back(
+            {0, vertices->buffer, stride, vertices->offset});
 
         if (!geometry.indices.empty()) {
-            u32 ebo = 0;
-            glGenBuffers(1, &ebo);
-            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
-            glBufferData(GL_ELEMENT_ARRAY_BUFFER,
-                         sizeof(geometry.indices[0]) * geometry.indices.size(),
-                         geometry.indices.data(), GL_STATIC_DRAW);
+            auto indices = stream.allocate(indices_size, index_size);
+            if (!indices) {
+                return std::nullopt;
+            }
+            write_indices(geometry, index_type, indices->data);
+            buffer.index_type = index_type;
+            buffer.ebo = indices->buffer;
+            buffer.index_offset = indices->offset;
         }
 
-        // TODO(panmar): Should I disable VertexAttribArray?
-        // According below it is not necessary:
-        // https://stackoverflow.com/questions/12427880/is-it-important-to-call-gldisablevertexattribarray
+        return buffer;
+    }
 
-        // TODO(panmar): Do I need to store it to release it later?
-        u32 vbo = 0;
-        glGenBuffers(1, &vbo);
-        glBindBuffer(GL_ARRAY_BUFFER, vbo);
-        glBufferData(GL_ARRAY_BUFFER,
-                     sizeof(geometry.positions[0]) * geometry.positions.size(),
-                     geometry.positions.data(), GL_STATIC_DRAW);
-
-        // Shader::INPUT_POSITION_ATTRIB
-
-        {
-            auto attrib_location =
-                shader.query_attrib_location(Shader::INPUT_POSITION_ATTRIB);
-            glEnableVertexAttribArray(attrib_location);
-            glVertexAttribPointer(attrib_location, 3, GL_FLOAT, false,
-                                  3 * sizeof(f32), (void*)0);
-        }
-
-        // Shader::INPUT_NORMAL_ATTRIB
-        if (!geometry.normals.empty() &&
-            shader.has_attrib(Shader::INPUT_NORMAL_ATTRIB)) {
-            glGenBuffers(1, &vbo);
-            glBindBuffer(GL_ARRAY_BUFFER, vbo);
-            glBufferData(GL_ARRAY_BUFFER,
-                         sizeof(vec3) * geometry.normals.size(),
-                         geometry.normals.data(), GL_STATIC_DRAW);
-            auto attrib_location =
-                shader.query_attrib_location(Shader::INPUT_NORMAL_ATTRIB);
-            glEnableVertexAttribArray(attrib_location);
-            glVertexAttribPointer(attrib_location, 3, GL_FLOAT, false,
-                                  3 * sizeof(f32), (void*)0);
-        }
-
-        // Shader::INPUT_TEXCOORD_ATTRIB
-        if (!geometry.texcoords.empty() &&
-            shader.has_attrib(Shader::INPUT_TEXCOORD_ATTRIB)) {
-            glGenBuffers(1, &vbo);
-            glBindBuffer(GL_ARRAY_BUFFER, vbo);
-            glBufferData(GL_ARRAY_BUFFER,
-                         sizeof(vec2) * geometry.texcoords.size(),
-                         geometry.texcoords.data(), GL_STATIC_DRAW);
-            auto attrib_location =
-                shader.query_attrib_location(Shader::INPUT_TEXCOORD_ATTRIB);
-            glEnableVertexAttribArray(attrib_location);
-            glVertexAttribPointer(attrib_location, 2, GL_FLOAT, false,
-                                  2 * sizeof(f32), (void*)0);
-        }
-
-        glBindVertexArray(0);
+    // NOTE(panmar): Vertices and indices share a single pool allocation;
+    // vertices are addressed with the base vertex, so the allocation is
+    // aligned to the stride (always a multiple of the index size)
+    static optional<GpuBuffer> from_pool(const Geometry& geometry,
+                                         VertexPool& pool,
+                                         VertexArrayCache& vertex_arrays) {
+        validate(geometry);
+
+        auto format = VertexFormat::from(geometry, VertexLayout::Interleaved);
+        auto stride = format.stride();
+        auto vertices_size = stride * geometry.positions.size();
+        auto index_type = index_type_for(geometry);
+        auto indices_size =
+            index_type_size(index_type) * geometry.indices.size();
+
+        auto allocation = pool.allocate(vertices_size + indices_size, stride);
+        if (!allocation) {
+            return std::nullopt;
+        }
+
+        auto data = vector<u8>(vertices_size);
+        auto quantization = interleave(geometry, format, data.data());
+        pool.upload(*allocation, 0, vertices_size, data.data());
+
+        auto buffer = GpuBuffer{};
+        buffer.quantization = quantization;
+        buffer.owning = false;
+        buffer.pool = &pool;
+        buffer.pool_allocation = *allocation;
+        buffer.format = format;
+        buffer.vao = vertex_arrays.get(format);
+        buffer.vertex_bindings.push_back({0, allocation->buffer, stride});
+        buffer.base_vertex = allocation->offset / stride;
+
+        if (!geometry.indices.empty()) {
+            auto indices = narrow_indices(geometry, index_type);
+            pool.upload(*allocation, vertices_size, indices_size,
+                        indices.data());
+            buffer.index_type = index_type;
+            buffer.ebo = allocation->buffer;
+            buffer.index_offset = allocation->offset + vertices_size;
+        }
 
         return buffer;
     }
 
     ~GpuBuffer() {
-        if (vao) {
-            glDeleteVertexArrays(1, &vao);
+        if (pool) {
+            pool->release(pool_allocation);
         }
 
-        if (vbo) {
-            glDeleteBuffers(1, &vbo);
+        if (!owning) {
+            return;
+        }
+
+        for (auto& binding : vertex_bindings) {
+            glDeleteBuffers(1, &binding.buffer);
+        }
+
+        if (ebo) {
+            glDeleteBuffers(1, &ebo);
         }
     }
 
-    static u64 generate_hash(const Geometry& geometry, const Shader& shader) {
-        static const string separator = "--#!@#!@#--";
+    static u64 size_in_bytes(const Geometry& geometry, VertexLayout layout) {
+        return VertexFormat::from(geometry, layout).stride() *
+                   geometry.positions.size() +
+               index_type_size(index_type_for(geometry)) *
+                   geometry.indices.size();
+    }
+
+    // NOTE(panmar): The narrowest index type able to address every vertex
+    static u32 index_type_for(const Geometry& geometry) {
+        auto vertex_count = geometry.positions.size();
+        if (vertex_count <= std::numeric_limits<u8>::max() + 1) {
+            return GL_UNSIGNED_BYTE;
+        }
+        if (vertex_count <= std::numeric_limits<u16>::max() + 1) {
+            return GL_UNSIGNED_SHORT;
+        }
+        return GL_UNSIGNED_INT;
+    }
+
+    static u64 generate_hash(const Geometry& geometry) {
         meow_state state;
         MeowBegin(&state, MeowDefaultSeed);
 
-        if (!geometry.positions.empty() &&
-            shader.has_attrib(Shader::INPUT_POSITION_ATTRIB)) {
-            MeowAbsorb(
-                &state,
-                geometry.positions.size() * sizeof(geometry.positions[0]),
-                (void*)(&geometry.positions.begin()->x));
+        auto absorb = [&state](const auto& data) {
+            u64 size = data.size() * sizeof(data[0]);
+            MeowAbsorb(&state, sizeof(size), &size);
+            if (size) {
+                MeowAbsorb(&state, size, (void*)data.data());
+            }
+        };
+
+        absorb(geometry.positions);
+        absorb(geometry.normals);
+        absorb(geometry.texcoords);
+        absorb(geometry.indices);
+
+        auto topology = static_cast<u32>(geometry.topology);
+        MeowAbsorb(&state, sizeof(topology), &topology);
+
+        auto quantized = static_cast<u32>(geometry.quantized);
+        MeowAbsorb(&state, sizeof(quantized), &quantized);
+
+        auto hash128 = MeowEnd(&state, nullptr);
+        return MeowU64From(hash128, 0);
+    }
+
+    // NOTE(panmar): The vao is shared between buffers of the same format and
+    // owned by the VertexArrayCache; the vertex and index buffers are owned
+    // by the GpuBuffer unless it is a view into a stream buffer
+    VertexFormat format;
+    u32 vao = 0;
+    vector<VertexBinding> vertex_bindings;
+    u32 ebo = 0;
+    u32 index_offset = 0;
+    u32 index_type = GL_UNSIGNED_INT;
+    i32 base_vertex = 0;
+    VertexQuantization quantization;
+    bool owning = true;
+
+    // NOTE(panmar): Set if the data lives in a VertexPool
+    VertexPool* pool = nullptr;
+    VertexPool::Allocation pool_allocation;
+
+private:
+    static void validate(const Geometry& geometry) {
+        if (geometry.positions.empty()) {
+            throw PlayGlException("Geometry has no positions.");
         }
 
-        MeowAbsorb(&state, separator.size() * sizeof(std::string::value_type),
-                   (void*)(separator.c_str()));
+        auto vertex_count = geometry.positions.size();
+        if ((!geometry.normals.empty() &&
+             geometry.normals.size() != vertex_count) ||
+            (!geometry.texcoords.empty() &&
+             geometry.texcoords.size() != vertex_count)) {
+            throw PlayGlException(
+                "Geometry attributes have different vertex counts.");
+        }
+    }
+
+    // NOTE(panmar): Returns how to map the written positions back to mesh
+    // space
+    static VertexQuantization interleave(const Geometry& geometry,
+                                         const VertexFormat& format, u8* data) {
+        auto stride = format.stride();
+        auto write = [data, stride](const auto& values, u32 offset,
+                                    auto encode) {
+            for (size_t i = 0; i < values.size(); ++i) {
+                auto value = encode(values[i]);
+                std::memcpy(&data[i * stride + offset], &value, sizeof(value));
+            }
+        };
+        auto identity = [](const auto& value) { return value; };
+
+        auto quantization = format.quantized
+                                ? quantization::bounds(geometry.positions)
+                                : VertexQuantization{};
 
-        if (!geometry.normals.empty() &&
-            shader.has_attrib(Shader::INPUT_NORMAL_ATTRIB)) {
-            MeowAbsorb(&state,
-                       geometry.normals.size() * sizeof(geometry.normals[0]),
-                       (void*)(&geometry.normals.begin()->x));
+        for (auto& attrib : format.attribs()) {
+            auto quantized = attrib.type != GL_FLOAT;
+            if (attrib.location == Shader::INPUT_POSITION_LOCATION) {
+                if (quantized) {
+                    write(geometry.positions, attrib.offset,
+                          [&quantization](const vec3& position) {
+                              return quantization::encode_position(
+                                  position, quantization);
+                          });
+                } else {
+                    write(geometry.positions, attrib.offset, identity);
+                }
+            } else if (attrib.location == Shader::INPUT_NORMAL_LOCATION) {
+                if (quantized) {
+                    write(geometry.normals, attrib.offset,
+                          quantization::encode_normal);
+                } else {
+                    write(geometry.normals, attrib.offset, identity);
+                }
+            } else if (attrib.location == Shader::INPUT_TEXCOORD_LOCATION) {
+                if (quantized) {
+                    write(geometry.texcoords, attrib.offset,
+                          quantization::encode_texcoord);
+                } else {
+                    write(geometry.texcoords, attrib.offset, identity);
+                }
+            }
         }
 
-        MeowAbsorb(&state, separator.size() * sizeof(std::string::value_type),
-                   (void*)(separator.c_str()));
+        return quantization;
+    }
+
+    static void write_indices(const Geometry& geometry, u32 index_type,
+                              u8* data) {
+        auto write = [&geometry, data](auto index) {
+            using IndexType = decltype(index);
+            auto indices = reinterpret_cast<IndexType*>(data);
+            for (u32 i = 0; i < geometry.indices.size(); ++i) {
+                indices[i] = static_cast<IndexType>(geometry.indices[i]);
+            }
+        };
 
-        if (!geometry.texcoords.empty() &&
-            shader.has_attrib(Shader::INPUT_TEXCOORD_ATTRIB)) {
-            MeowAbsorb(
-                &state,
-                geometry.texcoords.size() * sizeof(geometry.texcoords[0]),
-                (void*)(&geometry.texcoords.begin()->x));
+        if (index_type == GL_UNSIGNED_BYTE) {
+            write(u8{});
+        } else if (index_type == GL_UNSIGNED_SHORT) {
+            write(u16{});
+        } else {
+            std::memcpy(data, geometry.indices.data(),
+                        sizeof(u32) * geometry.indices.size());
         }
+    }
 
-        auto shader_source = shader.source();
-        MeowAbsorb(&state,
-                   shader_source.size() * sizeof(std::string::value_type),
-                   (void*)(shader_source.c_str()));
+    static vector<u8> narrow_indices(const Geometry& geometry,
+                                     u32 index_type) {
+        auto data = vector<u8>(index_type_size(index_type) *
+                               geometry.indices.size());
+        write_indices(geometry, index_type, data.data());
+        return data;
+    }
 
-        auto hash128 = MeowEnd(&state, nullptr);
-        auto hash64 = MeowU64From(hash128, 0);
-        return hash64;
+    // NOTE(panmar): Immutable storage, created without binding the buffer,
+    // so neither GL_ARRAY_BUFFER nor the element binding of the bound vao
+    // is touched
+    template <class T>
+    static u32 upload(const vector<T>& data) {
+        u32 vbo = 0;
+        glCreateBuffers(1, &vbo);
+        glNamedBufferStorage(vbo, sizeof(T) * data.size(), data.data(), 0);
+        return vbo;
+    }
+};
+
+class GeometryRegistry {
+public:
+    GeometryHandle add(Geometry&& geometry) {
+        auto handle = GeometryHandle{next_id++, 0};
+        entries.insert({handle.id, Entry{std::move(geometry), 0, 0}});
+        return handle;
     }
 
-    void bind() {
-        if (vao) {
-            glBindVertexArray(vao);
+    GeometryHandle add(const Geometry& geometry) {
+        return add(Geometry(geometry));
+    }
+
+    // NOTE(panmar): Opt-in dedupe path - the content is hashed once at
+    // registration, and identical geometry shares a single handle
+    GeometryHandle add_deduplicated(Geometry&& geometry) {
+        auto hash = GpuBuffer::generate_hash(geometry);
+        auto it = content_hash_to_id.find(hash);
+        if (it != content_hash_to_id.end()) {
+            auto& entry = entries.find(it->second)->second;
+            return GeometryHandle{it->second, entry.generation};
         }
+
+        auto handle = add(std::move(geometry));
+        entries.find(handle.id)->second.content_hash = hash;
+        content_hash_to_id.insert({hash, handle.id});
+        return handle;
+    }
+
+    void update(GeometryHandle& handle, Geometry&& geometry) {
+        auto& entry = find(handle);
+        forget_content_hash(entry);
+        entry.geometry = std::move(geometry);
+        handle.generation = ++entry.generation;
     }
 
-    void unbind() {}
+    void remove(const GeometryHandle& handle) {
+        auto& entry = find(handle);
+        forget_content_hash(entry);
+        entries.erase(handle.id);
+    }
 
-    u32 vbo = 0;
-    u32 vao = 0;
+    const Geometry& get(const GeometryHandle& handle) const {
+        return find(handle).geometry;
+    }
+
+private:
+    struct Entry {
+        Geometry geometry;
+        u32 generation = 0;
+        u64 content_hash = 0;
+    };
+
+    Entry& find(const GeometryHandle& handle) {
+        return const_cast<Entry&>(std::as_const(*this).find(handle));
+    }
+
+    const Entry& find(const GeometryHandle& handle) const {
+        auto it = entries.find(handle.id);
+        if (it == entries.end()) {
+            throw PlayGlException(
+                fmt::format("Geometry handle {} is not registered", handle.id));
+        }
+
+        if (it->second.generation != handle.generation) {
+            throw PlayGlException(fmt::format(
+                "Geometry handle {} is stale (generation {}, current {})",
+                handle.id, handle.generation, it->second.generation));
+        }
+
+        return it->second;
+    }
+
+    void forget_content_hash(Entry& entry) {
+        if (entry.content_hash) {
+            content_hash_to_id.erase(entry.content_hash);
+            entry.content_hash = 0;
+        }
+    }
+
+    u32 next_id = 1;
+    unordered_map<u32, Entry> entries;
+    unordered_map<u64, u32> content_hash_to_id;
+};
+
+struct GpuBufferCacheStats {
+    u64 hits = 0;
+    u64 misses = 0;
+    u64 evictions = 0;
+    u64 bytes_resident = 0;
+    u32 buffers_resident = 0;
 };
 
 class GpuBufferHashmap {
 public:
-    GpuBuffer& get(const Geometry& geometry, const Shader& shader) {
-        auto hash = GpuBuffer::generate_hash(geometry, shader);
-        if (hashed_buffers.count(hash)) {
-            return hashed_buffers.find(hash)->second;
-        } else {
-            // NOTE(panmar): Safety check - do our hashing works correctly?
-            constexpr auto MAX_HASHED_BUFFERS = 50;
-            if (hashed_buffers.size() > MAX_HASHED_BUFFERS) {
-                throw PlayGlException(
-                    "Maximum number of hashed buffers exceeded");
+    void set_layout(VertexLayout value) {
+        if (layout != value) {
+            layout = value;
+            clear();
+        }
+    }
+
+    void clear() {
+        for (auto& [hash, cached_buffer] : hashed_buffers) {
+            retire(std::move(cached_buffer.buffer));
+        }
+        for (auto& [id, versioned_buffer] : handle_buffers) {
+            retire(std::move(versioned_buffer.buffer));
+        }
+        hashed_buffers.clear();
+        lru.clear();
+        cache_stats.bytes_resident = 0;
+        cache_stats.buffers_resident = 0;
+        handle_buffers.clear();
+    }
+
+    // NOTE(panmar): Buffers dropped from the cache may still be referenced by
+    // draws recorded in the deferred RenderQueue, so they are kept until the
+    // queue has been flushed. Draws already issued are ordered before any
+    // later gl call reusing their storage, so no fence is needed.
+    void release_retired() { retired.clear(); }
+
+    // NOTE(panmar): Transient geometry is written into the stream buffer
+    // instead of being hashed and cached
+    optional<GpuBuffer> stream(const Geometry& geometry) {
+        return GpuBuffer::from_stream(geometry, stream_buffer, vertex_arrays);
+    }
+
+    optional<StreamBuffer::Allocation> allocate_stream(u32 size,
+                                                      u32 alignment) {
+        return stream_buffer.allocate(size, alignment);
+    }
+
+    u32 vertex_array(const VertexFormat& format) {
+        return vertex_arrays.get(format);
+    }
+
+    // NOTE(panmar): Eviction happens between frames, so buffers referenced
+    // by recorded (deferred) draws are never deleted mid-frame
+    void next_frame() {
+        stream_buffer.next_frame();
+        release_retired();
+
+        while (!lru.empty()) {
+            auto& entry = hashed_buffers.find(lru.back())->second;
+            auto unused_frames = frame - entry.last_used_frame;
+            if (unused_frames < config::gpu_buffer_cache_max_unused_frames &&
+                cache_stats.bytes_resident <= config::gpu_buffer_cache_budget) {
+                break;
             }
+            evict(lru.back());
+        }
 
-            auto gpu_buffer = GpuBuffer::from(geometry, shader);
-            return hashed_buffers.insert({hash, std::move(gpu_buffer)})
-                .first->second;
+        ++frame;
+    }
+
+    // NOTE(panmar): Registered geometry is looked up by its id; the vertex
+    // data is never touched unless the generation has changed. With the
+    // interleaved layout it is placed in the shared vertex pool, unless it
+    // is too big for a pool page.
+    GpuBuffer& get(const GeometryHandle& handle, const Geometry& geometry) {
+        auto it = handle_buffers.find(handle.id);
+        if (it != handle_buffers.end()) {
+            if (it->second.generation == handle.generation) {
+                return it->second.buffer;
+            }
+            retire(std::move(it->second.buffer));
+            handle_buffers.erase(it);
         }
+
+        auto pooled_buffer =
+            layout == VertexLayout::Interleaved
+                ? GpuBuffer::from_pool(geometry, vertex_pool, vertex_arrays)
+                : optional<GpuBuffer>{};
+
+        auto versioned_buffer = VersionedBuffer{
+            handle.generation,
+            pooled_buffer ? std::move(*pooled_buffer)
+                          : GpuBuffer::from(geometry, layout, vertex_arrays)};
+        return handle_buffers.insert({handle.id, std::move(versioned_buffer)})
+            .first->second.buffer;
     }
 
+    void remove(const GeometryHandle& handle) {
+        auto it = handle_buffers.find(handle.id);
+        if (it != handle_buffers.end()) {
+            retire(std::move(it->second.buffer));
+            handle_buffers.erase(it);
+        }
+    }
+
+    // NOTE(panmar): Content-hashed buffers form a residency cache with a
+    // byte budget. Before a new buffer is uploaded, least recently used
+    // buffers not drawn this frame are evicted until it fits; if everything
+    // is in use the budget is exceeded until the next frame.
+    GpuBuffer& get(const Geometry& geometry) {
+        auto hash = GpuBuffer::generate_hash(geometry);
+        auto it = hashed_buffers.find(hash);
+        if (it != hashed_buffers.end()) {
+            ++cache_stats.hits;
+            it->second.last_used_frame = frame;
+            lru.splice(lru.begin(), lru, it->second.lru_position);
+            return it->second.buffer;
+        }
+
+        ++cache_stats.misses;
+
+        auto bytes = GpuBuffer::size_in_bytes(geometry, layout);
+        while (!lru.empty() &&
+               cache_stats.bytes_resident + bytes >
+                   config::gpu_buffer_cache_budget) {
+            auto lru_hash = lru.back();
+            if (hashed_buffers.find(lru_hash)->second.last_used_frame ==
+                frame) {
+                break;
+            }
+            evict(lru_hash);
+        }
+
+        auto gpu_buffer = GpuBuffer::from(geometry, layout, vertex_arrays);
+        lru.push_front(hash);
+        auto cached_buffer =
+            CachedBuffer{std::move(gpu_buffer), bytes, frame, lru.begin()};
+        cache_stats.bytes_resident += bytes;
+        ++cache_stats.buffers_resident;
+        return hashed_buffers.insert({hash, std::move(cached_buffer)})
+            .first->second.buffer;
+    }
+
+    const GpuBufferCacheStats& stats() const { return cache_stats; }
+
 private:
-    unordered_map<u64, GpuBuffer> hashed_buffers;
+    struct VersionedBuffer {
+        u32 generation = 0;
+        GpuBuffer buffer;
+    };
+
+    struct CachedBuffer {
+        GpuBuffer buffer;
+        u64 bytes = 0;
+        u64 last_used_frame = 0;
+        std::list<u64>::iterator lru_position;
+    };
+
+    void evict(u64 hash) {
+        auto it = hashed_buffers.find(hash);
+        cache_stats.bytes_resident -= it->second.bytes;
+        --cache_stats.buffers_resident;
+        ++cache_stats.evictions;
+        lru.erase(it->second.lru_position);
+        retire(std::move(it->second.buffer));
+        hashed_buffers.erase(it);
+    }
+
+    void retire(GpuBuffer&& buffer) { retired.push_back(std::move(buffer)); }
+
+    VertexLayout layout = VertexLayout::Interleaved;
+    VertexArrayCache vertex_arrays;
+    StreamBuffer stream_buffer{config::stream_buffer_frame_size,
+                               "geometry_stream"};
+    VertexPool vertex_pool{config::vertex_pool_page_size, "vertex_pool"};
+    unordered_map<u64, CachedBuffer> hashed_buffers;
+    unordered_map<u32, VersionedBuffer> handle_buffers;
+    vector<GpuBuffer> retired;
+
+    // NOTE(panmar): Hashes of cached buffers, most recently used first
+    std::list<u64> lru;
+    u64 frame = 0;
+    GpuBufferCacheStats cache_stats;
 };
 
 class GeometryRendererCommand {
 public:
     GeometryRendererCommand(Content& content, Store& store,
+                            RenderQueue& render_queue,
                             GpuBufferHashmap& hashed_gpubuffers,
                             const Geometry& geometry)
         : content(content),
           store(store),
+          render_queue(render_queue),
           hashed_gpubuffers(hashed_gpubuffers),
           _geometry_ref(&geometry) {
         debug::scope_start("geometry:render");
     }
 
     GeometryRendererCommand(Content& content, Store& store,
+                            RenderQueue& render_queue,
+                            GpuBufferHashmap& hashed_gpubuffers,
+                            const GeometryHandle& handle,
+                            const Geometry& geometry)
+        : content(content),
+          store(store),
+          render_queue(render_queue),
+          hashed_gpubuffers(hashed_gpubuffers),
+          _handle(handle),
+          _geometry_ref(&geometry) {
+        debug::scope_start("geometry:render");
+    }
+
+    GeometryRendererCommand(Content& content, Store& store,
+                            RenderQueue& render_queue,
                             GpuBufferHashmap& hashed_gpubuffers,
                             Geometry&& geometry)
         : content(content),
           store(store),
+          render_queue(render_queue),
           hashed_gpubuffers(hashed_gpubuffers),
           _geometry(std::move(geometry)) {
         debug::scope_start("geometry:render");
@@ -222,8 +861,11 @@ public:
 
     ~GeometryRendererCommand() { debug::scope_end(); }
 
-    GeometryRendererCommand& shader(const string& vs_id, const string& fs_id) {
-        _shader = &content.shader(vs_id, fs_id);
+    // NOTE(panmar): Picks the program variant for the defines and the
+    // specialized store params; see shader_variants.h
+    GeometryRendererCommand& shader(const string& vs_id, const string& fs_id,
+                                    const ShaderDefines& defines = {}) {
+        _shader = &content.shader(vs_id, fs_id, defines, store);
         return *this;
     }
 
@@ -237,7 +879,7 @@ public:
         if (!_shader) {
             throw PlayGlException("Shader not set");
         }
-        _shader->param(name, param);
+        _params.emplace_back(name, param);
         return *this;
     }
 
@@ -246,6 +888,94 @@ public:
         return *this;
     }
 
+    // NOTE(panmar): Per-object constants read in the shader from the
+    // ObjectData storage buffer at `gl_BaseInstance` instead of uniforms; T
+    // has to match the std430 struct declared by the shader. In deferred
+    // mode consecutive draws of pooled geometry sharing shader, state and
+    // params are merged into one glMultiDraw*Indirect. The data is copied
+    // straight into the render queue's arena, so nothing is allocated per
+    // draw.
+    template <class T>
+    GeometryRendererCommand& object_data(const T& data) {
+        // NOTE(panmar): Keeps the std430 array stride equal to sizeof(T)
+        static_assert(std::is_trivially_copyable_v<T> && sizeof(T) % 16 == 0,
+                      "Object data has to be padded to a multiple of vec4");
+        _object_size = sizeof(T);
+        _object_offset = render_queue.push_object_data(&data, sizeof(T));
+        return *this;
+    }
+
+    // NOTE(panmar): Object data consisting of just the world matrix,
+    // transposed to match the `vec * world` convention of the `world` uniform
+    GeometryRendererCommand& batched(const mat4& world) {
+        return object_data(glm::transpose(world));
+    }
+
+    // NOTE(panmar): Distance used to order draws sharing the same shader,
+    // state and geometry in deferred mode; ignored otherwise
+    GeometryRendererCommand& depth(f32 value) {
+        _depth = value;
+        return *this;
+    }
+
+    // NOTE(panmar): Per-instance data is copied into the stream buffer right
+    // away, so the source does not need to outlive the command. The world
+    // matrices are transposed to match the `vec * world` convention used by
+    // the `world` uniform.
+    GeometryRendererCommand& instances(const mat4* worlds, u32 count) {
+        auto allocation = allocate_instance_stream(sizeof(mat4), count);
+        auto data = reinterpret_cast<mat4*>(allocation.data);
+        for (u32 i = 0; i < count; ++i) {
+            data[i] = glm::transpose(worlds[i]);
+        }
+
+        _instance_format.instance_world = true;
+        _instance_bindings.push_back({Shader::INPUT_INSTANCE_WORLD_LOCATION,
+                                      allocation.buffer, sizeof(mat4),
+                                      allocation.offset});
+        return *this;
+    }
+
+    GeometryRendererCommand& instances(const vector<mat4>& worlds) {
+        return instances(worlds.data(), worlds.size());
+    }
+
+    GeometryRendererCommand& instance_colors(const Color* colors, u32 count) {
+        auto allocation = allocate_instance_stream(sizeof(vec4), count);
+        std::memcpy(allocation.data, colors, sizeof(vec4) * count);
+
+        _instance_format.instance_color = true;
+        _instance_bindings.push_back({Shader::INPUT_INSTANCE_COLOR_LOCATION,
+                                      allocation.buffer, sizeof(vec4),
+                                      allocation.offset});
+        return *this;
+    }
+
+    GeometryRendererCommand& instance_colors(const vector<Color>& colors) {
+        return instance_colors(colors.data(), colors.size());
+    }
+
+    GeometryRendererCommand& instance_data(u32 slot, const vec4* data,
+                                           u32 count) {
+        if (slot >= Shader::MAX_INSTANCE_DATA) {
+            throw PlayGlException(
+                fmt::format("Instance data slot {} out of range", slot));
+        }
+
+        auto allocation = allocate_instance_stream(sizeof(vec4), count);
+        std::memcpy(allocation.data, data, sizeof(vec4) * count);
+
+        _instance_format.instance_data_mask |= 1 << slot;
+        auto location = Shader::INPUT_INSTANCE_DATA_LOCATION + slot;
+        _instance_bindings.push_back(
+            {location, allocation.buffer, sizeof(vec4), allocation.offset});
+        return *this;
+    }
+
+    GeometryRendererCommand& instance_data(u32 slot, const vector<vec4>& data) {
+        return instance_data(slot, data.data(), data.size());
+    }
+
     void render() {
         auto& geometry = get_geometry();
 
@@ -253,58 +983,85 @@ public:
             throw PlayGlException("Shader not set");
         }
 
-        auto& gpu_buffer = hashed_gpubuffers.get(geometry, *_shader);
-        gpu_buffer.bind();
+        // NOTE(panmar): Waiting for a precompiled program would stall the
+        // frame; the draw is dropped until the driver is done
+        if (!_shader->is_ready()) {
+            render_queue.skip();
+            return;
+        }
 
-        _shader->bind();
-        populate_shader_params_from_store(*_shader);
-        _state.bind();
+        // NOTE(panmar): Geometry moved into the command lives only for this
+        // draw; it goes through the stream buffer unless the frame region is
+        // full, in which case it falls back to the hashed path
+        auto streamed_buffer = _geometry_ref
+                                   ? optional<GpuBuffer>{}
+                                   : hashed_gpubuffers.stream(geometry);
 
-        if (geometry.indices.empty()) {
-            glDrawArrays(static_cast<i32>(geometry.topology), 0,
-                         geometry.positions.size());
-        } else {
-            glDrawElements(static_cast<i32>(geometry.topology),
-                           geometry.indices.size(), GL_UNSIGNED_INT, 0);
+        auto& gpu_buffer = streamed_buffer ? *streamed_buffer
+                           : _handle ? hashed_gpubuffers.get(*_handle, geometry)
+                                     : hashed_gpubuffers.get(geometry);
+        DrawPacket packet;
+        packet.shader = _shader;
+        packet.params = std::move(_params);
+        packet.state = _state;
+
+        packet.vao = gpu_buffer.vao;
+        packet.vertex_bindings = gpu_buffer.vertex_bindings;
+        packet.ebo = gpu_buffer.ebo;
+        packet.index_offset = gpu_buffer.index_offset;
+        packet.index_type = gpu_buffer.index_type;
+        packet.quantization = gpu_buffer.quantization;
+        packet.base_vertex = gpu_buffer.base_vertex;
+
+        if (_instance_count) {
+            auto format = gpu_buffer.format;
+            format.instance_world = _instance_format.instance_world;
+            format.instance_color = _instance_format.instance_color;
+            format.instance_data_mask = _instance_format.instance_data_mask;
+            packet.vao = hashed_gpubuffers.vertex_array(format);
+            packet.vertex_bindings.insert(packet.vertex_bindings.end(),
+                                          _instance_bindings.begin(),
+                                          _instance_bindings.end());
+        }
+
+        packet.topology = geometry.topology;
+        packet.indexed = !geometry.indices.empty();
+        packet.count = packet.indexed ? geometry.indices.size()
+                                      : geometry.positions.size();
+        packet.instance_count = _instance_count;
+
+        if (_object_size) {
+            if (_instance_count) {
+                throw PlayGlException("Batched draws can not be instanced");
+            }
+            packet.object_size = _object_size;
+            packet.object_offset = _object_offset;
         }
 
-        gpu_buffer.unbind();
-        _shader->unbind();
-        _state.unbind();
+        render_queue.submit(std::move(packet), _depth);
     }
 
 private:
-    void populate_shader_params_from_store(const Shader& shader) {
-        for (auto& key_value : store) {
-            auto& name = key_value.first;
-            auto& param = key_value.second;
-            if (param.has(StoreParam::Shader)) {
-                std::visit(
-                    [&name, &shader](auto&& arg) {
-                        using T = std::decay_t<decltype(arg)>;
-                        if constexpr (std::is_same_v<T, i32>) {
-                            shader.try_param(name.c_str(), arg);
-                        } else if constexpr (std::is_same_v<T, f32>) {
-                            shader.try_param(name.c_str(), arg);
-                        } else if constexpr (std::is_same_v<T, vec2>) {
-                            shader.try_param(name.c_str(), arg);
-                        } else if constexpr (std::is_same_v<T, vec3>) {
-                            shader.try_param(name.c_str(), arg);
-                        } else if constexpr (std::is_same_v<T, vec4>) {
-                            shader.try_param(name.c_str(), arg);
-                        } else if constexpr (std::is_same_v<T, mat4>) {
-                            shader.try_param(name.c_str(), arg);
-                        } else if constexpr (std::is_same_v<T, Color>) {
-                            shader.try_param(name.c_str(), arg);
-                        } else if constexpr (std::is_same_v<T, string>) {
-                            // NOTE(panmar): Not supported
-                        } else {
-                            static_assert(false);
-                        }
-                    },
-                    param.param);
-            }
+    StreamBuffer::Allocation allocate_instance_stream(u32 element_size,
+                                                      u32 count) {
+        if (!count) {
+            throw PlayGlException("Instance data is empty");
+        }
+
+        if (_instance_count && _instance_count != count) {
+            throw PlayGlException(
+                fmt::format("Instance data count {} does not match {}", count,
+                            _instance_count));
+        }
+        _instance_count = count;
+
+        auto allocation =
+            hashed_gpubuffers.allocate_stream(element_size * count, 16);
+        if (!allocation) {
+            throw PlayGlException(
+                "Instance data exceeds the stream buffer capacity");
         }
+        return *allocation;
     }
 
     const Geometry& get_geometry() {
@@ -316,20 +1073,30 @@ private:
 
     Content& content;
     Store& store;
+    RenderQueue& render_queue;
     GpuBufferHashmap& hashed_gpubuffers;
 
+    optional<GeometryHandle> _handle;
     const Geometry* _geometry_ref = nullptr;
     Geometry _geometry;
 
     Shader* _shader = nullptr;
 
+    vector<std::pair<string, ShaderParamValue>> _params;
     GpuState _state;
+    f32 _depth = 0.f;
+    u32 _object_offset = 0;
+    u32 _object_size = 0;
+
+    u32 _instance_count = 0;
+    VertexFormat _instance_format;
+    vector<VertexBinding> _instance_bindings;
 };
 
 class GeometryRenderer {
 public:
     GeometryRenderer(Content& content, Store& store)
-        : content(content), store(store) {}
+        : content(content), store(store), render_queue(store) {}
 
     GeometryRendererCommand operator()(const Geometry& _geometry) {
         return command(_geometry);
@@ -339,18 +1106,80 @@ public:
         return command(std::move(_geometry));
     }
 
+    GeometryRendererCommand operator()(const GeometryHandle& handle) {
+        return GeometryRendererCommand(content, store, render_queue,
+                                       hashed_gpubuffers, handle,
+                                       geometries.get(handle));
+    }
+
+    GeometryHandle add(Geometry&& geometry) {
+        return geometries.add(std::move(geometry));
+    }
+
+    GeometryHandle add(const Geometry& geometry) {
+        return geometries.add(geometry);
+    }
+
+    GeometryHandle add_deduplicated(Geometry&& geometry) {
+        return geometries.add_deduplicated(std::move(geometry));
+    }
+
+    void update(GeometryHandle& handle, Geometry&& geometry) {
+        geometries.update(handle, std::move(geometry));
+    }
+
+    void remove(const GeometryHandle& handle) {
+        geometries.remove(handle);
+        hashed_gpubuffers.remove(handle);
+    }
+
+    const Geometry& get(const GeometryHandle& handle) const {
+        return geometries.get(handle);
+    }
+
+    // NOTE(panmar): Should be called once per frame, after the frame has been
+    // submitted
+    void next_frame() {
+        render_queue.next_frame();
+        hashed_gpubuffers.next_frame();
+    }
+
+    // NOTE(panmar): In deferred mode commands are recorded and submitted
+    // sorted by flush(); the app flushes after pgl_render and after the debug
+    // pass. Turning it off flushes what has been recorded.
+    void deferred(bool enabled) { render_queue.deferred(enabled); }
+
+    void flush() {
+        render_queue.flush();
+        hashed_gpubuffers.release_retired();
+    }
+
+    const RenderQueueStats& queue_stats() const { return render_queue.stats(); }
+
+    const GpuBufferCacheStats& cache_stats() const {
+        return hashed_gpubuffers.stats();
+    }
+
+    // NOTE(panmar): Changing the layout drops all cached gpu buffers; they
+    // are re-uploaded with the new layout on the next draw
+    void vertex_layout(VertexLayout layout) {
+        hashed_gpubuffers.set_layout(layout);
+    }
+
 private:
     GeometryRendererCommand command(const Geometry& geometry) {
-        return GeometryRendererCommand(content, store, hashed_gpubuffers,
-                                       geometry);
+        return GeometryRendererCommand(content, store, render_queue,
+                                       hashed_gpubuffers, geometry);
     }
 
     GeometryRendererCommand command(Geometry&& geometry) {
-        return GeometryRendererCommand(content, store, hashed_gpubuffers,
-                                       std::move(geometry));
+        return GeometryRendererCommand(content, store, render_queue,
+                                       hashed_gpubuffers, std::move(geometry));
     }
 
     Content& content;
     Store& store;
+    RenderQueue render_queue;
+    GeometryRegistry geometries;
     GpuBufferHashmap hashed_gpubuffers;
 };
@@ -2,11 +2,14 @@
 
 #include "graphics/logging.h"
 #include "graphics/geometry.h"
+#include "graphics/geometry_optimizer.h"
 #include "graphics/state.h"
 #include "graphics/texture.h"
 #include "graphics/shader.h"
 #include "graphics/model.h"
 #include "graphics/camera.h"
+#include "graphics/store_uniform_buffer.h"
+#include "graphics/render_queue.h"
 #include "graphics/geometry_renderer.h"
 #include "graphics/framebuffer.h"
 #include "graphics/debug_render.h"
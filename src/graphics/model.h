@@ -6,7 +6,9 @@
 #include <tiny_gltf.h>
 
 #include "common.h"
+#include "config.h"
 #include "graphics/geometry.h"
+#include "graphics/geometry_optimizer.h"
 #include "resource.h"
 
 struct ModelPart {
@@ -16,6 +18,9 @@ struct ModelPart {
     string name;
     Geometry geometry;
     mat4 transform = mat4(1.f);
+    // NOTE(panmar): Set if the part was optimized at import, see
+    // config::optimize_imported_meshes
+    optional<geometry::OptimizationReport> optimization;
 };
 
 struct ModelData {
@@ -62,9 +67,16 @@ public:
                 parent_transforms[child_node_index] = absolute_node_transform;
             }
 
-            auto& model_part = model_data.parts.emplace_back(
-                node.name, create_geometry_from_mesh(node.mesh, model),
-                absolute_node_transform);
+            auto geometry = create_geometry_from_mesh(node.mesh, model);
+            optional<geometry::OptimizationReport> optimization;
+            if constexpr (config::optimize_imported_meshes) {
+                optimization = geometry::optimize(geometry);
+            }
+
+            model_data.parts
+                .emplace_back(node.name, std::move(geometry),
+                              absolute_node_transform)
+                .optimization = optimization;
         }
 
         return model_data;
@@ -101,28 +113,42 @@ public:
         return local_transform * parent_transforms[node_index];
     }
 
+    // NOTE(panmar): Indices are kept as u32 on the cpu side in whatever
+    // width the file uses; the upload narrows them again to the smallest type
+    // that can address the vertices
+    static vector<u32> read_indices(const tinygltf::Model& model,
+                                    i32 accessor_index) {
+        auto& accessor = model.accessors[accessor_index];
+        auto& view = model.bufferViews[accessor.bufferView];
+        auto data = &model.buffers[view.buffer]
+                         .data[view.byteOffset + accessor.byteOffset];
+
+        auto read = [&accessor, data](auto index) {
+            using IndexType = decltype(index);
+            auto begin = reinterpret_cast<const IndexType*>(data);
+            return vector<u32>(begin, begin + accessor.count);
+        };
+
+        switch (accessor.componentType) {
+            case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+                return read(u8{});
+            case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
+                return read(u16{});
+            case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT:
+                return read(u32{});
+            default:
+                throw PlayGlException(
+                    fmt::format("Unsupported index component type {}",
+                                accessor.componentType));
+        }
+    }
+
     static Geometry create_geometry_from_mesh(i32 mesh_id,
                                               const tinygltf::Model& model) {
         Geometry geometry;
         auto& mesh = model.meshes[mesh_id];
         for (const auto& primitive : mesh.primitives) {
-            const auto& indices_view_index = primitive.indices;
-            auto& indices_buffer_index =
-                model.bufferViews[indices_view_index].buffer;
-            auto& indices_byte_offset =
-                model.bufferViews[indices_view_index].byteOffset;
-            auto& indices_byte_length =
-                model.bufferViews[indices_view_index].byteLength;
-            auto& indices_byte_stride =
-                model.bufferViews[indices_view_index].byteStride;
-            auto begin = reinterpret_cast<const u16*>(
-                &model.buffers[indices_buffer_index].data[indices_byte_offset]);
-            auto end = reinterpret_cast<const u16*>(
-                &model.buffers[indices_buffer_index]
-                     .data[indices_byte_offset + indices_byte_length]);
-            auto indices_u16 = vector<u16>(begin, end);
-            geometry.indices =
-                vector<u32>(indices_u16.begin(), indices_u16.end());
+            geometry.indices = read_indices(model, primitive.indices);
 
             for (const auto& named_attribute : primitive.attributes) {
                 auto& name = named_attribute.first;
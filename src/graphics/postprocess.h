@@ -24,7 +24,8 @@ public:
                 FramebufferContainer& framebuffers)
         : content(content),
           geometry_renderer(geometry_renderer),
-          framebuffers(framebuffers) {}
+          framebuffers(framebuffers),
+          screen_quad(geometry_renderer.add(geometry::ScreenQuad{})) {}
 
     template <class... StringType>
     Postprocess& operator()(StringType&... ids) {
@@ -32,7 +33,7 @@ public:
     }
 
     Postprocess& with(const string& fragment_shader_id) {
-        shader = &content.shader("postprocess.vs", fragment_shader_id);
+        shader = &content.shader_pipeline("postprocess.vs", fragment_shader_id);
         return *this;
     }
 
@@ -43,7 +44,7 @@ public:
                 "Postprocess: `with` argument should be passed before "
                 "`param`");
         }
-        shader->param(name, value);
+        params.emplace_back(name, value);
         return *this;
     }
 
@@ -61,19 +62,26 @@ public:
 
         framebuffer.color().bind();
 
+        // NOTE(panmar): Params go through the command, so they stay with the
+        // draw when the GeometryRenderer is deferred
+        auto command = geometry_renderer(screen_quad);
+        command.shader(*shader)
+            .param("transform", mat4(1.f))
+            .state(GpuState().nodepth());
+
         u32 i = 0;
         for (auto& framebuffer : input_framebuffers) {
             auto param_name = "tex" + std::to_string(i);
-            shader->param(param_name.c_str(),
+            command.param(param_name.c_str(),
                           framebuffer->color_texture.value());
             ++i;
         }
 
-        geometry_renderer(geometry::ScreenQuad{})
-            .shader(*shader)
-            .param("transform", mat4(1.f))
-            .state(GpuState().nodepth())
-            .render();
+        for (auto& [name, value] : params) {
+            command.param(name.c_str(), value);
+        }
+
+        command.render();
 
         command_cleanup();
     }
@@ -90,6 +98,7 @@ private:
 
     void command_cleanup() {
         input_framebuffers.clear();
+        params.clear();
         shader = nullptr;
     }
 
@@ -100,7 +109,9 @@ private:
     Content& content;
     GeometryRenderer& geometry_renderer;
     FramebufferContainer& framebuffers;
+    GeometryHandle screen_quad;
 
     vector<Framebuffer*> input_framebuffers;
+    vector<std::pair<string, ShaderParamValue>> params;
     Shader* shader = nullptr;
 };
@@ -0,0 +1,641 @@
+#pragma once
+
+#include <glad/glad.h>
+#define GLFW_INCLUDE_GLU
+#include <GLFW/glfw3.h>
+
+#include "common.h"
+#include "config.h"
+#include "graphics/geometry.h"
+#include "graphics/shader.h"
+#include "graphics/state.h"
+#include "graphics/stream_buffer.h"
+#include "graphics/vertex_quantization.h"
+#include "store.h"
+
+struct VertexBinding {
+    u32 index = 0;
+    u32 buffer = 0;
+    u32 stride = 0;
+    u32 offset = 0;
+
+    bool operator==(const VertexBinding& other) const {
+        return index == other.index && buffer == other.buffer &&
+               stride == other.stride && offset == other.offset;
+    }
+
+    bool operator!=(const VertexBinding& other) const {
+        return !(*this == other);
+    }
+};
+
+struct FramebufferBinding {
+    i32 framebuffer = 0;
+    array<i32, 4> viewport = {};
+
+    bool operator==(const FramebufferBinding& other) const {
+        return framebuffer == other.framebuffer && viewport == other.viewport;
+    }
+
+    bool operator!=(const FramebufferBinding& other) const {
+        return !(*this == other);
+    }
+};
+
+inline u32 index_type_size(u32 index_type) {
+    switch (index_type) {
+        case GL_UNSIGNED_BYTE:
+            return sizeof(u8);
+        case GL_UNSIGNED_SHORT:
+            return sizeof(u16);
+        default:
+            return sizeof(u32);
+    }
+}
+
+// NOTE(panmar): Everything needed to issue a single draw, resolved when the
+// command is recorded
+struct DrawPacket {
+    optional<FramebufferBinding> framebuffer;
+    const Shader* shader = nullptr;
+    vector<std::pair<string, ShaderParamValue>> params;
+    GpuState state;
+
+    u32 vao = 0;
+    vector<VertexBinding> vertex_bindings;
+    u32 ebo = 0;
+    u32 index_offset = 0;
+    u32 index_type = GL_UNSIGNED_INT;
+    i32 base_vertex = 0;
+    VertexQuantization quantization;
+
+    // NOTE(panmar): Per-object constants of batched draws, a range of the
+    // queue's object arena; read by the shader at `gl_BaseInstance` from the
+    // ObjectData storage buffer
+    u32 object_offset = 0;
+    u32 object_size = 0;
+
+    Geometry::Topology topology = Geometry::Topology::Triangles;
+    u32 count = 0;
+    bool indexed = false;
+    u32 instance_count = 0;
+};
+
+// NOTE(panmar): The `saved` counters are binds that were skipped compared to
+// binding everything for every draw
+struct RenderQueueStats {
+    u32 draws = 0;
+    // NOTE(panmar): Draws dropped because their program was still compiling
+    u32 draws_skipped = 0;
+    u32 flushes = 0;
+
+    // NOTE(panmar): Multi-draw submissions and the draws merged into them
+    u32 batches = 0;
+    u32 batched_draws = 0;
+
+    u32 framebuffer_binds = 0;
+    u32 shader_binds = 0;
+    u32 state_binds = 0;
+    u32 vertex_array_binds = 0;
+    u32 vertex_buffer_binds = 0;
+    // NOTE(panmar): glBindTextures/glBindSamplers calls, each covering all
+    // texture units that changed for a draw
+    u32 texture_binds = 0;
+
+    u32 framebuffer_binds_saved = 0;
+    u32 shader_binds_saved = 0;
+    u32 state_binds_saved = 0;
+    u32 vertex_array_binds_saved = 0;
+    u32 vertex_buffer_binds_saved = 0;
+};
+
+// NOTE(panmar): In deferred mode draws are recorded with a 64-bit sort key
+//
+//     [63..56] pass          - bumped whenever the target framebuffer changes
+//     [55..44] shader
+//     [43..36] gpu state
+//     [35..16] geometry
+//     [15..0]  depth
+//
+// and submitted sorted on flush, skipping binds that did not change. Runs of
+// batched draws that end up next to each other are merged. Passes
+// keep their recording order, so rendering into a framebuffer and sampling
+// it afterwards still works. GL calls made outside of the GeometryRenderer
+// (e.g. Framebuffer::clear) are not ordered with recorded draws; flush first.
+class RenderQueue {
+public:
+    RenderQueue(Store& store)
+        : store(store),
+          draw_stream(config::draw_stream_buffer_frame_size, "draw_stream") {}
+
+    RenderQueue(const RenderQueue&) = delete;
+    RenderQueue& operator=(const RenderQueue&) = delete;
+
+    bool deferred() const { return _deferred; }
+
+    void deferred(bool enabled) {
+        if (!enabled) {
+            flush();
+        }
+        _deferred = enabled;
+    }
+
+    // NOTE(panmar): Copies per-object constants into the arena, which lives
+    // until the draws using it are submitted; returns the offset for
+    // DrawPacket::object_offset
+    u32 push_object_data(const void* data, u32 size) {
+        auto offset = static_cast<u32>(object_arena.size());
+        auto bytes = static_cast<const u8*>(data);
+        object_arena.insert(object_arena.end(), bytes, bytes + size);
+        return offset;
+    }
+
+    void skip() { ++current_stats.draws_skipped; }
+
+    void submit(DrawPacket&& packet, f32 depth = 0.f) {
+        if (!_deferred) {
+            bind(packet, nullptr);
+            if (packet.object_size) {
+                draw_batched({&packet});
+            } else {
+                draw(packet);
+            }
+            finish(packet);
+            object_arena.clear();
+            return;
+        }
+
+        packet.framebuffer = current_framebuffer();
+        if (!packets.empty() &&
+            packets.back().framebuffer != packet.framebuffer) {
+            if (pass == MAX_PASS) {
+                // NOTE(panmar): The packet's object data is already in the
+                // arena, which flush clears
+                vector<u8> object_data(
+                    object_arena.begin() + packet.object_offset,
+                    object_arena.begin() + packet.object_offset +
+                        packet.object_size);
+                flush();
+                packet.object_offset =
+                    push_object_data(object_data.data(), packet.object_size);
+            } else {
+                ++pass;
+            }
+        }
+
+        auto key = (static_cast<u64>(pass) << 56) |
+                   (static_cast<u64>(intern_shader(packet.shader)) << 44) |
+                   (static_cast<u64>(intern_state(packet.state)) << 36) |
+                   (static_cast<u64>(intern_geometry(packet)) << 16) |
+                   depth_bits(depth);
+
+        sort_items.push_back({key, static_cast<u32>(packets.size())});
+        packets.push_back(std::move(packet));
+    }
+
+    void flush() {
+        if (packets.empty()) {
+            return;
+        }
+
+        DEBUG_SCOPE("render-queue:flush");
+
+        auto restore_framebuffer = current_framebuffer();
+
+        radix_sort(sort_items, scratch_items);
+
+        const DrawPacket* previous = nullptr;
+        for (u32 i = 0; i < sort_items.size();) {
+            auto& packet = packets[sort_items[i].index];
+            bind(packet, previous);
+
+            if (packet.object_size) {
+                batch.clear();
+                for (; i < sort_items.size(); ++i) {
+                    auto& next = packets[sort_items[i].index];
+                    if (!batchable(packet, next)) {
+                        break;
+                    }
+                    batch.push_back(&next);
+                }
+                draw_batched(batch);
+            } else {
+                draw(packet);
+                ++i;
+            }
+
+            previous = &packet;
+        }
+        finish(*previous);
+
+        GpuStateCache::glBindFramebuffer(restore_framebuffer.framebuffer);
+        GpuStateCache::glViewport(
+            restore_framebuffer.viewport[0], restore_framebuffer.viewport[1],
+            restore_framebuffer.viewport[2], restore_framebuffer.viewport[3]);
+
+        ++current_stats.flushes;
+
+        packets.clear();
+        object_arena.clear();
+        sort_items.clear();
+        shader_ids.clear();
+        state_ids.clear();
+        geometry_ids.clear();
+        pass = 0;
+    }
+
+    // NOTE(panmar): Stats of the last finished frame
+    const RenderQueueStats& stats() const { return last_frame_stats; }
+
+    void next_frame() {
+        last_frame_stats = current_stats;
+        current_stats = {};
+        draw_stream.next_frame();
+    }
+
+private:
+    struct DrawElementsIndirectCommand {
+        u32 count = 0;
+        u32 instance_count = 0;
+        u32 first_index = 0;
+        i32 base_vertex = 0;
+        u32 base_instance = 0;
+    };
+
+    struct DrawArraysIndirectCommand {
+        u32 count = 0;
+        u32 instance_count = 0;
+        u32 first = 0;
+        u32 base_instance = 0;
+    };
+
+    struct SortItem {
+        u64 key = 0;
+        u32 index = 0;
+    };
+
+    static constexpr u32 MAX_PASS = 0xFF;
+    static constexpr u32 SHADER_MASK = 0xFFF;
+    static constexpr u32 STATE_MASK = 0xFF;
+    static constexpr u32 GEOMETRY_MASK = 0xFFFFF;
+
+    // NOTE(panmar): Ids only have to group equal values; if there are more
+    // values than bits, some groups share an id and sorting gets worse, but
+    // binds are still compared by value
+    u32 intern_shader(const Shader* shader) {
+        auto it = shader_ids.find(shader);
+        if (it == shader_ids.end()) {
+            it = shader_ids.insert({shader, shader_ids.size()}).first;
+        }
+        return it->second & SHADER_MASK;
+    }
+
+    u32 intern_state(const GpuState& state) {
+        auto it = state_ids.find(state.hash());
+        if (it == state_ids.end()) {
+            it = state_ids.insert({state.hash(), state_ids.size()}).first;
+        }
+        return it->second & STATE_MASK;
+    }
+
+    u32 intern_geometry(const DrawPacket& packet) {
+        auto key = (static_cast<u64>(packet.vao) << 48) ^
+                   (static_cast<u64>(packet.ebo) << 24);
+        for (auto& binding : packet.vertex_bindings) {
+            key ^= binding.buffer;
+        }
+
+        auto it = geometry_ids.find(key);
+        if (it == geometry_ids.end()) {
+            it = geometry_ids.insert({key, geometry_ids.size()}).first;
+        }
+        return it->second & GEOMETRY_MASK;
+    }
+
+    // NOTE(panmar): Bits of non-negative floats sort like the floats
+    static u64 depth_bits(f32 depth) {
+        depth = std::max(depth, 0.f);
+        u32 bits = 0;
+        std::memcpy(&bits, &depth, sizeof(bits));
+        return bits >> 16;
+    }
+
+    static void radix_sort(vector<SortItem>& items, vector<SortItem>& scratch) {
+        scratch.resize(items.size());
+        for (u32 shift = 0; shift < 64; shift += 8) {
+            array<u32, 256> offsets = {};
+            for (auto& item : items) {
+                ++offsets[(item.key >> shift) & 0xFF];
+            }
+
+            // NOTE(panmar): Every key has the same byte; nothing to reorder
+            if (offsets[(items.front().key >> shift) & 0xFF] == items.size()) {
+                continue;
+            }
+
+            u32 sum = 0;
+            for (auto& offset : offsets) {
+                auto count = offset;
+                offset = sum;
+                sum += count;
+            }
+
+            for (auto& item : items) {
+                scratch[offsets[(item.key >> shift) & 0xFF]++] = item;
+            }
+            items.swap(scratch);
+        }
+    }
+
+    // NOTE(panmar): Read from GpuStateCache's shadow copy, so recording a
+    // draw does not wait on a glGet round-trip
+    static FramebufferBinding current_framebuffer() {
+        return {static_cast<i32>(GpuStateCache::framebuffer()),
+                GpuStateCache::viewport()};
+    }
+
+    void bind(const DrawPacket& packet, const DrawPacket* previous) {
+        auto& stats = current_stats;
+
+        if (packet.framebuffer) {
+            if (previous && previous->framebuffer == packet.framebuffer) {
+                ++stats.framebuffer_binds_saved;
+            } else {
+                auto& viewport = packet.framebuffer->viewport;
+                GpuStateCache::glBindFramebuffer(
+                    packet.framebuffer->framebuffer);
+                GpuStateCache::glViewport(viewport[0], viewport[1],
+                                          viewport[2], viewport[3]);
+                ++stats.framebuffer_binds;
+            }
+        }
+
+        if (previous && previous->shader == packet.shader) {
+            ++stats.shader_binds_saved;
+        } else {
+            if (previous) {
+                previous->shader->unbind();
+            }
+            packet.shader->bind();
+            ++stats.shader_binds;
+        }
+
+        // NOTE(panmar): Program state, so it only has to be set when either
+        // the program or the quantization changes
+        if (!previous || previous->shader != packet.shader ||
+            previous->quantization != packet.quantization) {
+            set_quantization_params(*packet.shader, packet.quantization);
+        }
+
+        for (auto& [name, value] : packet.params) {
+            packet.shader->param(name.c_str(), value);
+        }
+        packet.shader->params_from_store(store);
+        stats.texture_binds += TextureUnitCache::flush();
+
+        if (previous && previous->state == packet.state) {
+            ++stats.state_binds_saved;
+        } else {
+            if (previous) {
+                previous->state.unbind();
+            }
+            packet.state.bind();
+            ++stats.state_binds;
+        }
+
+        auto same_vao = previous && previous->vao == packet.vao;
+        if (same_vao) {
+            ++stats.vertex_array_binds_saved;
+        } else {
+            glBindVertexArray(packet.vao);
+            ++stats.vertex_array_binds;
+        }
+
+        for (u32 i = 0; i < packet.vertex_bindings.size(); ++i) {
+            auto& binding = packet.vertex_bindings[i];
+            if (same_vao && i < previous->vertex_bindings.size() &&
+                previous->vertex_bindings[i] == binding) {
+                ++stats.vertex_buffer_binds_saved;
+                continue;
+            }
+            glBindVertexBuffer(binding.index, binding.buffer, binding.offset,
+                               binding.stride);
+            ++stats.vertex_buffer_binds;
+        }
+
+        if (!same_vao || previous->ebo != packet.ebo) {
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, packet.ebo);
+        }
+    }
+
+    static void set_quantization_params(
+        const Shader& shader, const VertexQuantization& quantization) {
+        if (!shader.has_param("QUANTIZED")) {
+            return;
+        }
+
+        shader.param("QUANTIZED", quantization.enabled);
+        shader.param("QUANTIZATION_OFFSET", quantization.offset);
+        shader.param("QUANTIZATION_SCALE", quantization.scale);
+    }
+
+    static void finish(const DrawPacket& packet) {
+        packet.shader->unbind();
+        packet.state.unbind();
+    }
+
+    void draw(const DrawPacket& packet) {
+        ++current_stats.draws;
+
+        auto topology = static_cast<i32>(packet.topology);
+        if (!packet.indexed) {
+            if (packet.instance_count) {
+                glDrawArraysInstanced(topology, packet.base_vertex,
+                                      packet.count, packet.instance_count);
+            } else {
+                glDrawArrays(topology, packet.base_vertex, packet.count);
+            }
+            return;
+        }
+
+        auto indices_offset = reinterpret_cast<void*>(
+            static_cast<uintptr_t>(packet.index_offset));
+        if (packet.instance_count) {
+            glDrawElementsInstancedBaseVertex(
+                topology, packet.count, packet.index_type, indices_offset,
+                packet.instance_count, packet.base_vertex);
+        } else {
+            glDrawElementsBaseVertex(topology, packet.count, packet.index_type,
+                                     indices_offset, packet.base_vertex);
+        }
+    }
+
+    // NOTE(panmar): Draws that differ only in their object data and the
+    // range they take from the same vertex and element buffers
+    static bool batchable(const DrawPacket& first, const DrawPacket& other) {
+        return other.object_size == first.object_size &&
+               first.framebuffer == other.framebuffer &&
+               first.shader == other.shader && first.state == other.state &&
+               first.vao == other.vao &&
+               first.vertex_bindings == other.vertex_bindings &&
+               first.ebo == other.ebo && first.index_type == other.index_type &&
+               first.topology == other.topology &&
+               first.quantization == other.quantization &&
+               first.indexed == other.indexed &&
+               equal_params(first.params, other.params);
+    }
+
+    static bool equal_params(
+        const vector<std::pair<string, ShaderParamValue>>& lhs,
+        const vector<std::pair<string, ShaderParamValue>>& rhs) {
+        if (lhs.size() != rhs.size()) {
+            return false;
+        }
+
+        for (u32 i = 0; i < lhs.size(); ++i) {
+            if (lhs[i].first != rhs[i].first ||
+                lhs[i].second.index() != rhs[i].second.index()) {
+                return false;
+            }
+
+            auto equal = std::visit(
+                [&rhs = rhs[i].second](auto&& arg) {
+                    using T = std::decay_t<decltype(arg)>;
+                    auto& other = std::get<T>(rhs);
+                    if constexpr (std::is_same_v<T, Color>) {
+                        return arg.r == other.r && arg.g == other.g &&
+                               arg.b == other.b && arg.a == other.a;
+                    } else if constexpr (std::is_same_v<
+                                             T, std::reference_wrapper<
+                                                    const Texture>>) {
+                        return &arg.get() == &other.get();
+                    } else {
+                        return arg == other;
+                    }
+                },
+                lhs[i].second);
+            if (!equal) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // NOTE(panmar): Runs larger than the free space of the draw stream are
+    // split into chunks; once the current region is full, the stream moves on
+    // to its next region
+    void draw_batched(const vector<const DrawPacket*>& draws) {
+        auto& first = *draws.front();
+        auto command_size = first.indexed ? sizeof(DrawElementsIndirectCommand)
+                                          : sizeof(DrawArraysIndirectCommand);
+        auto draw_size = static_cast<u32>(first.object_size + command_size);
+        // NOTE(panmar): Worst-case padding of the commands placed after the
+        // object data
+        auto padding = static_cast<u32>(sizeof(u32));
+
+        for (size_t begin = 0; begin < draws.size();) {
+            auto free = draw_stream.available(storage_buffer_alignment());
+            if (free < padding + draw_size) {
+                draw_stream.next_frame();
+                free = draw_stream.available(storage_buffer_alignment());
+                if (free < padding + draw_size) {
+                    throw PlayGlException(
+                        "Draw stream buffer capacity exceeded");
+                }
+            }
+
+            auto count = std::min<size_t>(draws.size() - begin,
+                                          (free - padding) / draw_size);
+            draw_batched_chunk(draws.data() + begin, static_cast<u32>(count));
+            begin += count;
+        }
+    }
+
+    // NOTE(panmar): Object data and indirect commands are written into the
+    // draw stream; draw i reads its object data at gl_BaseInstance == i
+    void draw_batched_chunk(const DrawPacket* const* draws, u32 count) {
+        auto& first = *draws[0];
+        auto objects_size = first.object_size * count;
+
+        auto objects =
+            draw_stream.allocate(objects_size, storage_buffer_alignment());
+        auto commands_size = first.indexed
+                                 ? sizeof(DrawElementsIndirectCommand) * count
+                                 : sizeof(DrawArraysIndirectCommand) * count;
+        auto commands = draw_stream.allocate(commands_size, sizeof(u32));
+        if (!objects || !commands) {
+            throw PlayGlException("Draw stream buffer capacity exceeded");
+        }
+
+        for (u32 i = 0; i < count; ++i) {
+            std::memcpy(objects->data + first.object_size * i,
+                        object_arena.data() + draws[i]->object_offset,
+                        first.object_size);
+        }
+        glBindBufferRange(GL_SHADER_STORAGE_BUFFER,
+                          Shader::OBJECT_DATA_BINDING, objects->buffer,
+                          objects->offset, objects_size);
+
+        auto topology = static_cast<i32>(first.topology);
+        auto indirect =
+            reinterpret_cast<void*>(static_cast<uintptr_t>(commands->offset));
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commands->buffer);
+        if (first.indexed) {
+            auto command_data =
+                reinterpret_cast<DrawElementsIndirectCommand*>(commands->data);
+            for (u32 i = 0; i < count; ++i) {
+                auto& draw = *draws[i];
+                auto first_index =
+                    draw.index_offset / index_type_size(draw.index_type);
+                command_data[i] = {draw.count, 1, first_index,
+                                   draw.base_vertex, i};
+            }
+            glMultiDrawElementsIndirect(topology, first.index_type, indirect,
+                                        count, 0);
+        } else {
+            auto command_data =
+                reinterpret_cast<DrawArraysIndirectCommand*>(commands->data);
+            for (u32 i = 0; i < count; ++i) {
+                auto& draw = *draws[i];
+                command_data[i] = {draw.count, 1,
+                                   static_cast<u32>(draw.base_vertex), i};
+            }
+            glMultiDrawArraysIndirect(topology, indirect, count, 0);
+        }
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+        current_stats.draws += count;
+        ++current_stats.batches;
+        current_stats.batched_draws += count;
+    }
+
+    u32 storage_buffer_alignment() {
+        if (!_storage_buffer_alignment) {
+            i32 alignment = 0;
+            glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT,
+                          &alignment);
+            _storage_buffer_alignment = std::max(alignment, 16);
+        }
+        return _storage_buffer_alignment;
+    }
+
+    Store& store;
+    bool _deferred = false;
+
+    StreamBuffer draw_stream;
+    vector<const DrawPacket*> batch;
+    u32 _storage_buffer_alignment = 0;
+
+    vector<DrawPacket> packets;
+    vector<u8> object_arena;
+    vector<SortItem> sort_items;
+    vector<SortItem> scratch_items;
+    u32 pass = 0;
+
+    unordered_map<const Shader*, u32> shader_ids;
+    unordered_map<u64, u32> state_ids;
+    unordered_map<u64, u32> geometry_ids;
+
+    RenderQueueStats current_stats;
+    RenderQueueStats last_frame_stats;
+};
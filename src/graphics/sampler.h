@@ -0,0 +1,88 @@
+#pragma once
+
+#include <glad/glad.h>
+#define GLFW_INCLUDE_GLU
+#include <GLFW/glfw3.h>
+
+#include "meow_hash.h"
+
+#include "common.h"
+#include "graphics/state.h"
+#include "resource.h"
+
+struct SamplerDesc {
+    enum class Filter {
+        Nearest = GL_NEAREST,
+        Linear = GL_LINEAR,
+        NearestMipmapNearest = GL_NEAREST_MIPMAP_NEAREST,
+        LinearMipmapNearest = GL_LINEAR_MIPMAP_NEAREST,
+        NearestMipmapLinear = GL_NEAREST_MIPMAP_LINEAR,
+        LinearMipmapLinear = GL_LINEAR_MIPMAP_LINEAR
+    };
+
+    enum class Wrap {
+        Repeat = GL_REPEAT,
+        MirroredRepeat = GL_MIRRORED_REPEAT,
+        ClampToEdge = GL_CLAMP_TO_EDGE,
+        ClampToBorder = GL_CLAMP_TO_BORDER
+    };
+
+    Filter min_filter = Filter::LinearMipmapLinear;
+    Filter mag_filter = Filter::Linear;
+    Wrap wrap_s = Wrap::Repeat;
+    Wrap wrap_t = Wrap::Repeat;
+    // NOTE(panmar): 1 disables anisotropic filtering
+    f32 max_anisotropy = 1.f;
+
+    // NOTE(panmar): Hash of the whole desc, samplers are deduplicated by it
+    u64 key() const {
+        meow_state state;
+        MeowBegin(&state, MeowDefaultSeed);
+        MeowAbsorb(&state, sizeof(*this), (void*)this);
+        return MeowU64From(MeowEnd(&state, nullptr), 0);
+    }
+};
+
+// NOTE(panmar): Sampling parameters as a separate GL object, so one texture
+// can be sampled in several ways. A texture sampled without one uses the
+// parameters set on the texture itself. Samplers are deduplicated by desc in
+// Content, see Content::sampler.
+class Sampler : public LazyResource<u32> {
+public:
+    static Sampler from_desc(const SamplerDesc& desc) { return Sampler{desc}; }
+
+    const SamplerDesc desc;
+
+private:
+    Sampler(const SamplerDesc& desc)
+        : LazyResource(sampler_resource_deleter), desc(desc) {}
+
+    virtual u32 create_resource() const override {
+        u32 sampler = 0;
+        glCreateSamplers(1, &sampler);
+        glSamplerParameteri(sampler, GL_TEXTURE_MIN_FILTER,
+                            static_cast<i32>(desc.min_filter));
+        glSamplerParameteri(sampler, GL_TEXTURE_MAG_FILTER,
+                            static_cast<i32>(desc.mag_filter));
+        glSamplerParameteri(sampler, GL_TEXTURE_WRAP_S,
+                            static_cast<i32>(desc.wrap_s));
+        glSamplerParameteri(sampler, GL_TEXTURE_WRAP_T,
+                            static_cast<i32>(desc.wrap_t));
+        if (desc.max_anisotropy > 1.f) {
+            glSamplerParameterf(sampler, GL_TEXTURE_MAX_ANISOTROPY,
+                                desc.max_anisotropy);
+        }
+
+        debug::label(fmt::format("sampler_{:016x}", desc.key()), GL_SAMPLER,
+                     sampler);
+        return sampler;
+    }
+
+    static void sampler_resource_deleter(u32& resource) {
+        if (resource) {
+            TextureUnitCache::forget_sampler(resource);
+            glDeleteSamplers(1, &resource);
+            resource = 0;
+        }
+    }
+};
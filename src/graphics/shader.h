@@ -5,8 +5,61 @@
 #include <GLFW/glfw3.h>
 
 #include "common.h"
+#include "graphics/shader_binary_cache.h"
+#include "graphics/shader_preprocessor.h"
+#include "graphics/shader_reflection.h"
 #include "graphics/texture.h"
 #include "resource.h"
+#include "store.h"
+
+// NOTE(panmar): A recorded uniform value; textures are referenced, so they
+// have to outlive the draw that uses them
+using ShaderParamValue =
+    std::variant<bool, i32, f32, vec2, vec3, vec4, Color, glm::mat2, glm::mat3,
+                 mat4, std::reference_wrapper<const Texture>, SampledTexture>;
+
+static_assert(ShaderReflection::MAX_SAMPLERS <= TextureUnitCache::MAX_UNITS);
+
+// NOTE(panmar): GL_KHR_parallel_shader_compile (or the equivalent ARB
+// extension) lets the driver compile and link on its own threads, and adds a
+// non-blocking completion query. It is not part of the loaded gl api, so the
+// entry point is fetched by hand.
+class ParallelShaderCompile {
+public:
+    static constexpr u32 GL_COMPLETION_STATUS = 0x91B1;
+
+    // NOTE(panmar): Requires a current context
+    static void setup() {
+        using MaxShaderCompilerThreads = void(APIENTRY*)(u32);
+        MaxShaderCompilerThreads max_threads = nullptr;
+        if (glfwExtensionSupported("GL_KHR_parallel_shader_compile")) {
+            max_threads = reinterpret_cast<MaxShaderCompilerThreads>(
+                glfwGetProcAddress("glMaxShaderCompilerThreadsKHR"));
+        } else if (glfwExtensionSupported("GL_ARB_parallel_shader_compile")) {
+            max_threads = reinterpret_cast<MaxShaderCompilerThreads>(
+                glfwGetProcAddress("glMaxShaderCompilerThreadsARB"));
+        }
+
+        _supported = max_threads != nullptr;
+        if (_supported) {
+            // NOTE(panmar): Let the driver pick the number of threads
+            max_threads(0xFFFFFFFF);
+        }
+    }
+
+    static bool supported() { return _supported; }
+
+private:
+    static inline bool _supported = false;
+};
+
+struct UniformStats {
+    u64 location_hits = 0;
+    u64 location_misses = 0;
+    u64 uploads = 0;
+    // NOTE(panmar): Uploads of the value the uniform already holds
+    u64 uploads_skipped = 0;
+};
 
 class Shader : public LazyResource<u32> {
 public:
@@ -14,186 +67,308 @@ public:
     static constexpr const char* INPUT_NORMAL_ATTRIB = "IN_NORMAL";
     static constexpr const char* INPUT_TEXCOORD_ATTRIB = "IN_TEXCOORD";
 
+    // NOTE(panmar): Vertex inputs are bound to fixed locations before linking,
+    // so gpu buffers do not depend on a particular shader
+    static constexpr u32 INPUT_POSITION_LOCATION = 0;
+    static constexpr u32 INPUT_NORMAL_LOCATION = 1;
+    static constexpr u32 INPUT_TEXCOORD_LOCATION = 2;
+
+    // NOTE(panmar): Per-instance inputs; the world matrix takes 4 locations
+    static constexpr const char* INPUT_INSTANCE_WORLD_ATTRIB =
+        "IN_INSTANCE_WORLD";
+    static constexpr const char* INPUT_INSTANCE_COLOR_ATTRIB =
+        "IN_INSTANCE_COLOR";
+    static constexpr const char* INPUT_INSTANCE_DATA_ATTRIBS[] = {
+        "IN_INSTANCE_DATA0", "IN_INSTANCE_DATA1", "IN_INSTANCE_DATA2",
+        "IN_INSTANCE_DATA3"};
+    static constexpr u32 INPUT_INSTANCE_WORLD_LOCATION = 3;
+    static constexpr u32 INPUT_INSTANCE_COLOR_LOCATION = 7;
+    static constexpr u32 INPUT_INSTANCE_DATA_LOCATION = 8;
+    static constexpr u32 MAX_INSTANCE_DATA = 4;
+
+    // NOTE(panmar): Storage buffer binding of the per-object data of batched
+    // draws, indexed with `gl_BaseInstance`
+    static constexpr u32 OBJECT_DATA_BINDING = 0;
+
+    // NOTE(panmar): Uniform buffer binding of the `Store` block, see
+    // store_uniform_buffer.h
+    static constexpr u32 STORE_BLOCK_BINDING = 0;
+    static constexpr const char* STORE_BLOCK_PRAGMA = "#pragma store";
+    static inline string store_block_declaration;
+
     static Shader from_text(const string& vs_text, const string& fs_text) {
         return Shader(vs_text, fs_text);
     }
 
-    static Shader from_file(const Path& vs_path, const Path& fs_path) {
-        return Shader(vs_path, fs_path);
+    // NOTE(panmar): Without a preprocessor `#include` is left to the driver;
+    // `prelude` is inserted right after the `#version` line of both stages
+    static Shader from_file(const Path& vs_path, const Path& fs_path,
+                            ShaderPreprocessor* preprocessor = nullptr,
+                            const string& prelude = "") {
+        return Shader(vs_path, fs_path, preprocessor, prelude);
+    }
+
+    // NOTE(panmar): A program of a single stage (GL_VERTEX_SHADER or
+    // GL_FRAGMENT_SHADER), linked separable so it can be shared by pipelines
+    static Shader stage_from_file(u32 stage, const Path& path,
+                                  ShaderPreprocessor* preprocessor = nullptr) {
+        auto vertex = stage == GL_VERTEX_SHADER;
+        auto shader = Shader(vertex ? path : Path(), vertex ? Path() : path,
+                             preprocessor, "");
+        shader.stage = stage;
+        return shader;
+    }
+
+    // NOTE(panmar): A program pipeline combining two stage programs at bind
+    // time; the stages have to outlive it. Params go to the stage declaring
+    // them, or to both.
+    static Shader pipeline(const Shader& vertex_stage,
+                           const Shader& fragment_stage) {
+        if (vertex_stage.stage != GL_VERTEX_SHADER ||
+            fragment_stage.stage != GL_FRAGMENT_SHADER) {
+            throw PlayGlException("Pipeline stages have to be stage programs");
+        }
+        return Shader(vertex_stage, fragment_stage);
     }
 
     bool has_attrib(const char* name) const {
-        return glGetAttribLocation(resource(), name) != -1;
+        return reflection().input(name) != nullptr;
+    }
+
+    bool has_param(const char* name) const {
+        return static_cast<bool>(reflection().uniform_element(name));
     }
 
     i32 query_attrib_location(const char* name) const {
-        return glGetAttribLocation(resource(), name);
+        auto input = reflection().input(name);
+        return input ? input->location : -1;
     }
 
-    template <class ParamType>
-    const Shader& try_param(const char* name, const ParamType& value) const {
-        try {
-            return param(name, value);
-        } catch (const PlayGlException& ex) {
-            return *this;
+    // NOTE(panmar): Submits compiling and linking without waiting for the
+    // result; the program is finished on first use. Programs in the binary
+    // cache are loaded right away.
+    void compile_async() const {
+        if (vertex_stage) {
+            vertex_stage->compile_async();
+            fragment_stage->compile_async();
+            return;
         }
-    }
 
-    const Shader& param(const char* name, bool value) const {
-        auto location = glGetUniformLocation(resource(), name);
-        if (location == -1) {
-            throw PlayGlException(
-                fmt::format("Shader[{}:{}]: Could not find param `{}`",
-                            vs_path.filename().string(),
-                            fs_path.filename().string(), name));
+        if (has_resource() || pending) {
+            return;
         }
-        bind();
-        glUniform1i(location, static_cast<i32>(value));
-        return *this;
-    }
 
-    const Shader& param(const char* name, i32 value) const {
-        auto location = glGetUniformLocation(resource(), name);
-        if (location == -1) {
-            throw PlayGlException(
-                fmt::format("Shader[{}:{}]: Could not find param `{}`",
-                            vs_path.filename().string(),
-                            fs_path.filename().string(), name));
+        vs_hash = load_source(vs_path, vs_text, vs_files);
+        fs_hash = load_source(fs_path, fs_text, fs_files);
+
+        inject_prelude(vs_text);
+        inject_prelude(fs_text);
+
+        auto store_block = inject_store_block(vs_text);
+        store_block = inject_store_block(fs_text) || store_block;
+        auto injected_hash =
+            prelude.empty() && !store_block
+                ? 0
+                : shader_source_hash(
+                      prelude + (store_block ? store_block_declaration : ""));
+
+        auto start = std::chrono::high_resolution_clock::now();
+        pending = std::make_unique<PendingProgram>();
+        pending->program = glCreateProgram();
+        if (stage) {
+            // NOTE(panmar): Also needed before loading a binary
+            glProgramParameteri(pending->program, GL_PROGRAM_SEPARABLE,
+                                GL_TRUE);
         }
-        bind();
-        glUniform1i(location, value);
-        return *this;
+        pending->cache_key =
+            ShaderBinaryCache::key(vs_hash, fs_hash, injected_hash);
+        pending->cached =
+            ShaderBinaryCache::load(pending->program, pending->cache_key);
+        if (!pending->cached) {
+            compile_and_link(*pending);
+        }
+
+        std::chrono::duration<f32, std::milli> elapsed =
+            std::chrono::high_resolution_clock::now() - start;
+        pending->submit_ms = elapsed.count();
     }
 
-    const Shader& param(const char* name, f32 value) const {
-        auto location = glGetUniformLocation(resource(), name);
-        if (location == -1) {
-            throw PlayGlException(
-                fmt::format("Shader[{}:{}]: Could not find param `{}`",
-                            vs_path.filename().string(),
-                            fs_path.filename().string(), name));
+    // NOTE(panmar): False only while an asynchronous compile is still running
+    // on driver threads; a program that was never submitted is compiled
+    // synchronously on first use, and without parallel shader compile there
+    // is no way to ask without waiting
+    bool is_ready() const {
+        if (vertex_stage) {
+            return vertex_stage->is_ready() && fragment_stage->is_ready();
         }
-        bind();
-        glUniform1f(location, value);
-        return *this;
-    }
 
-    const Shader& param(const char* name, const glm::vec2& value) const {
-        auto location = glGetUniformLocation(resource(), name);
-        if (location == -1) {
-            throw PlayGlException(
-                fmt::format("Shader[{}:{}]: Could not find param `{}`",
-                            vs_path.filename().string(),
-                            fs_path.filename().string(), name));
+        if (!pending || pending->cached ||
+            !ParallelShaderCompile::supported()) {
+            return true;
         }
-        bind();
-        glUniform2fv(location, 1, &value[0]);
-        return *this;
+
+        i32 completed = 0;
+        glGetProgramiv(pending->program,
+                       ParallelShaderCompile::GL_COMPLETION_STATUS,
+                       &completed);
+        return completed != 0;
     }
 
-    const Shader& param(const char* name, const glm::vec3& value) const {
-        auto location = glGetUniformLocation(resource(), name);
-        if (location == -1) {
-            throw PlayGlException(
-                fmt::format("Shader[{}:{}]: Could not find param `{}`",
-                            vs_path.filename().string(),
-                            fs_path.filename().string(), name));
+    // NOTE(panmar): Drops the program if one of the given files is its
+    // source and the expanded source changed; it is rebuilt on next use
+    bool reload_if_changed(const ShaderPathSet& changed) {
+        if (!preprocessor || (!has_resource() && !pending) ||
+            (!changed.count(vs_path) && !changed.count(fs_path))) {
+            return false;
         }
-        bind();
-        glUniform3fv(location, 1, &value[0]);
-        return *this;
+
+        auto source_changed = [this](const Path& path, u64 hash) {
+            return !path.empty() && preprocessor->expand(path).hash != hash;
+        };
+        if (!source_changed(vs_path, vs_hash) &&
+            !source_changed(fs_path, fs_hash)) {
+            return false;
+        }
+
+        release();
+        pending.reset();
+        bound = false;
+        store_bindings_program = 0;
+        return true;
     }
 
-    const Shader& param(const char* name, const glm::vec4& value) const {
-        auto location = glGetUniformLocation(resource(), name);
-        if (location == -1) {
-            throw PlayGlException(
-                fmt::format("Shader[{}:{}]: Could not find param `{}`",
-                            vs_path.filename().string(),
-                            fs_path.filename().string(), name));
+    const ShaderReflection& reflection() const {
+        if (vertex_stage) {
+            sync_pipeline_stages();
+        } else {
+            resource();
         }
-        bind();
-        glUniform4fv(location, 1, &value[0]);
-        return *this;
+        return _reflection;
     }
 
-    const Shader& param(const char* name, const Color& value) const {
-        auto location = glGetUniformLocation(resource(), name);
-        if (location == -1) {
-            throw PlayGlException(
-                fmt::format("Shader[{}:{}]: Could not find param `{}`",
-                            vs_path.filename().string(),
-                            fs_path.filename().string(), name));
+    template <class ParamType>
+    const Shader& try_param(const char* name, const ParamType& value) const {
+        try {
+            return param(name, value);
+        } catch (const PlayGlException& ex) {
+            return *this;
         }
-        bind();
-        glUniform4fv(location, 1, value.data);
-        return *this;
     }
 
-    const Shader& param(const char* name, const glm::mat2& value) const {
-        auto location = glGetUniformLocation(resource(), name);
-        if (location == -1) {
-            throw PlayGlException(
-                fmt::format("Shader[{}:{}]: Could not find param `{}`",
-                            vs_path.filename().string(),
-                            fs_path.filename().string(), name));
+    template <class ParamType>
+    const Shader& param(const char* name, const ParamType& value) const {
+        if (vertex_stage) {
+            return pipeline_param(name, value);
+        }
+
+        auto uniform = uniform_of(name);
+        if (!uniform_type_matches<ParamType>(uniform.uniform->type)) {
+            throw_param_error(name, "has a different type");
         }
-        bind();
-        glUniformMatrix2fv(location, 1, GL_TRUE, &value[0][0]);
+
+        upload(uniform.location(), value);
         return *this;
     }
 
-    const Shader& param(const char* name, const glm::mat3& value) const {
-        auto location = glGetUniformLocation(resource(), name);
-        if (location == -1) {
-            throw PlayGlException(
-                fmt::format("Shader[{}:{}]: Could not find param `{}`",
-                            vs_path.filename().string(),
-                            fs_path.filename().string(), name));
+    // NOTE(panmar): Samplers get their texture units at link time, so binding
+    // a texture does not touch the program
+    const Shader& param(const char* name, const Texture& texture) const {
+        return param(name, SampledTexture{&texture, nullptr});
+    }
+
+    const Shader& param(const char* name, const SampledTexture& texture) const {
+        if (vertex_stage) {
+            return pipeline_param(name, texture);
         }
-        bind();
-        glUniformMatrix3fv(location, 1, GL_TRUE, &value[0][0]);
+
+        auto uniform = uniform_of(name);
+        if (uniform.sampler_unit() == -1) {
+            throw_param_error(name, "is not a sampler");
+        }
+
+        texture.texture->bind(uniform.sampler_unit(), texture.sampler);
         return *this;
     }
 
-    const Shader& param(const char* name, const glm::mat4& value) const {
-        auto location = glGetUniformLocation(resource(), name);
-        if (location == -1) {
-            throw PlayGlException(
-                fmt::format("Shader[{}:{}]: Could not find param `{}`",
-                            vs_path.filename().string(),
-                            fs_path.filename().string(), name));
-        }
-        bind();
-        glUniformMatrix4fv(location, 1, GL_TRUE, &value[0][0]);
+    const Shader& param(const char* name, const ShaderParamValue& value) const {
+        std::visit(
+            [this, name](auto&& arg) {
+                using T = std::decay_t<decltype(arg)>;
+                if constexpr (std::is_same_v<
+                                  T, std::reference_wrapper<const Texture>>) {
+                    param(name, arg.get());
+                } else {
+                    param(name, arg);
+                }
+            },
+            value);
         return *this;
     }
 
-    const Shader& param(const char* name, const Texture& texture) const {
-        auto location = glGetUniformLocation(resource(), name);
-        if (location == -1) {
-            throw PlayGlException(
-                fmt::format("Shader[{}:{}]: Could not find param `{}`",
-                            vs_path.filename().string(),
-                            fs_path.filename().string(), name));
+    // NOTE(panmar): Uploads the store params this program declares. The store
+    // is matched against the program's uniforms only when params are added
+    // to it, so a draw never looks up (or throws on) undeclared params.
+    const Shader& params_from_store(Store& store) const {
+        if (vertex_stage) {
+            sync_pipeline_stages();
+            for (auto stage : {vertex_stage, fragment_stage}) {
+                stage->params_from_store(store);
+            }
+            return *this;
         }
 
-        constexpr u32 MAX_SAMPELRS = 8;
-        if (current_sampler_slot > MAX_SAMPELRS) {
-            throw PlayGlException("Number of samplers exceeded");
+        auto& bindings = store_bindings(store);
+        if (bindings.empty()) {
+            return *this;
         }
 
-        bind();
-        texture.bind(current_sampler_slot);
-        param(name, static_cast<i32>(current_sampler_slot));
-        ++current_sampler_slot;
+        for (auto& binding : bindings) {
+            if (!binding.param->has(StoreParam::Shader)) {
+                continue;
+            }
+
+            std::visit(
+                [this, &binding](auto&& arg) {
+                    using T = std::decay_t<decltype(arg)>;
+                    if constexpr (!std::is_same_v<T, string>) {
+                        if (uniform_type_matches<T>(binding.type)) {
+                            upload(binding.location, arg);
+                        }
+                    }
+                },
+                binding.param->param);
+        }
         return *this;
     }
 
+    // NOTE(panmar): Counters of all shaders, for the last completed frame
+    static const UniformStats& uniform_stats() { return last_frame_stats; }
+
+    static void next_frame() {
+        last_frame_stats = current_stats;
+        current_stats = {};
+    }
+
+    // NOTE(panmar): A bound program takes precedence over a bound pipeline,
+    // so binding a pipeline unbinds the current program. Stage programs are
+    // only used through pipelines and are never bound themselves.
     void bind() const {
+        if (stage) {
+            return;
+        }
+
+        if (vertex_stage) {
+            sync_pipeline_stages();
+            if (!bound) {
+                glUseProgram(0);
+                glBindProgramPipeline(resource());
+                bound = true;
+            }
+            return;
+        }
+
         if (resource() && !bound) {
             glUseProgram(resource());
-            current_sampler_slot = 0;
             bound = true;
         }
     }
@@ -204,6 +379,10 @@ public:
     }
 
     string source() const {
+        if (vertex_stage) {
+            return vertex_stage->source() + fragment_stage->source();
+        }
+
         resource();
         // TODO(panmar): Could be cached
         return vs_text + fs_text;
@@ -215,45 +394,226 @@ private:
           vs_text(vs_text),
           fs_text(fs_text) {}
 
-    Shader(const Path& vs_path, const Path& fs_path)
+    Shader(const Path& vs_path, const Path& fs_path,
+           ShaderPreprocessor* preprocessor, const string& prelude)
         : LazyResource(shader_resource_deleter),
           vs_path(vs_path),
-          fs_path(fs_path) {}
+          fs_path(fs_path),
+          preprocessor(preprocessor),
+          prelude(prelude) {}
+
+    Shader(const Shader& vertex_stage, const Shader& fragment_stage)
+        : LazyResource(pipeline_resource_deleter),
+          vs_path(vertex_stage.vs_path),
+          fs_path(fragment_stage.fs_path),
+          vertex_stage(&vertex_stage),
+          fragment_stage(&fragment_stage) {}
+
+    // NOTE(panmar): A program between `compile_async` and first use; deletes
+    // what it still owns if the shader goes away before that
+    struct PendingProgram {
+        u32 program = 0;
+        u32 vs = 0;
+        u32 fs = 0;
+        ShaderBinaryCache::Key cache_key = 0;
+        bool cached = false;
+        f32 submit_ms = 0.f;
+
+        PendingProgram() = default;
+        PendingProgram(const PendingProgram&) = delete;
+        PendingProgram& operator=(const PendingProgram&) = delete;
+
+        ~PendingProgram() {
+            if (vs) {
+                glDeleteShader(vs);
+            }
+            if (fs) {
+                glDeleteShader(fs);
+            }
+            if (program) {
+                glDeleteProgram(program);
+            }
+        }
+    };
 
-    virtual u32 create_resource() const override {
-        if (!vs_path.empty()) {
-            vs_text = read_file(vs_path);
+    struct StoreBinding {
+        const StoreParam* param = nullptr;
+        i32 location = -1;
+        u32 type = 0;
+    };
+
+    // NOTE(panmar): `name` may also be an element of an array, `name[N]`
+    ShaderReflection::UniformElement uniform_of(const char* name) const {
+        auto uniform = reflection().uniform_element(name);
+        if (!uniform) {
+            ++current_stats.location_misses;
+            throw_param_error(name, "could not be found");
         }
+        ++current_stats.location_hits;
+        return uniform;
+    }
+
+    [[noreturn]] void throw_param_error(const char* name,
+                                        const char* error) const {
+        throw PlayGlException(fmt::format("Shader[{}:{}]: Param `{}` {}",
+                                          vs_path.filename().string(),
+                                          fs_path.filename().string(), name,
+                                          error));
+    }
 
-        if (!fs_path.empty()) {
-            fs_text = read_file(fs_path);
+    const vector<StoreBinding>& store_bindings(Store& store) const {
+        auto program = resource();
+        if (store_bindings_program == program &&
+            store_bindings_store == &store &&
+            store_bindings_version == store.version()) {
+            return _store_bindings;
         }
 
-        auto vs = glCreateShader(GL_VERTEX_SHADER);
-        const char* vs_cstr = vs_text.c_str();
-        glShaderSource(vs, 1, &vs_cstr, nullptr);
-        glCompileShader(vs);
-        log_shader_errors_if_any(vs);
+        _store_bindings.clear();
+        for (auto& [name, param] : store) {
+            auto uniform = _reflection.uniform(name);
+            if (uniform && uniform->sampler_unit == -1) {
+                _store_bindings.push_back(
+                    {&param, uniform->location, uniform->type});
+            }
+        }
 
-        auto fs = glCreateShader(GL_FRAGMENT_SHADER);
-        const char* fs_cstr = fs_text.c_str();
-        glShaderSource(fs, 1, &fs_cstr, nullptr);
-        glCompileShader(fs);
-        log_shader_errors_if_any(fs);
+        store_bindings_program = program;
+        store_bindings_store = &store;
+        store_bindings_version = store.version();
+        return _store_bindings;
+    }
 
-        u32 program = glCreateProgram();
-        glAttachShader(program, vs);
-        glAttachShader(program, fs);
-        glLinkProgram(program);
-        log_program_errors_if_any(program);
+    // NOTE(panmar): Uniforms keep their values while other programs are
+    // bound, so an upload of the last uploaded value can be skipped. Uploads
+    // go to the program directly, it does not have to be bound.
+    template <class T>
+    void upload(i32 location, const T& value) const {
+        static_assert(std::is_trivially_copyable_v<T> &&
+                      sizeof(T) <= sizeof(UniformShadow::data));
+
+        auto& shadow = uniform_shadows[location];
+        if (shadow.size == sizeof(T) &&
+            std::memcmp(shadow.data.data(), &value, sizeof(T)) == 0) {
+            ++current_stats.uploads_skipped;
+            return;
+        }
+
+        shadow.size = sizeof(T);
+        std::memcpy(shadow.data.data(), &value, sizeof(T));
+        upload_uniform(resource(), location, value);
+        ++current_stats.uploads;
+    }
+
+    static void upload_uniform(u32 program, i32 location, bool value) {
+        glProgramUniform1i(program, location, static_cast<i32>(value));
+    }
+
+    static void upload_uniform(u32 program, i32 location, i32 value) {
+        glProgramUniform1i(program, location, value);
+    }
 
-        glDeleteShader(vs);
-        glDeleteShader(fs);
+    static void upload_uniform(u32 program, i32 location, f32 value) {
+        glProgramUniform1f(program, location, value);
+    }
+
+    static void upload_uniform(u32 program, i32 location,
+                               const glm::vec2& value) {
+        glProgramUniform2fv(program, location, 1, &value[0]);
+    }
+
+    static void upload_uniform(u32 program, i32 location,
+                               const glm::vec3& value) {
+        glProgramUniform3fv(program, location, 1, &value[0]);
+    }
+
+    static void upload_uniform(u32 program, i32 location,
+                               const glm::vec4& value) {
+        glProgramUniform4fv(program, location, 1, &value[0]);
+    }
+
+    static void upload_uniform(u32 program, i32 location, const Color& value) {
+        glProgramUniform4fv(program, location, 1, value.data);
+    }
+
+    static void upload_uniform(u32 program, i32 location,
+                               const glm::mat2& value) {
+        glProgramUniformMatrix2fv(program, location, 1, GL_TRUE,
+                                  &value[0][0]);
+    }
+
+    static void upload_uniform(u32 program, i32 location,
+                               const glm::mat3& value) {
+        glProgramUniformMatrix3fv(program, location, 1, GL_TRUE,
+                                  &value[0][0]);
+    }
+
+    static void upload_uniform(u32 program, i32 location,
+                               const glm::mat4& value) {
+        glProgramUniformMatrix4fv(program, location, 1, GL_TRUE,
+                                  &value[0][0]);
+    }
+
+    virtual u32 create_resource() const override {
+        if (vertex_stage) {
+            return create_pipeline();
+        }
+
+        compile_async();
+
+        auto start = std::chrono::high_resolution_clock::now();
+        auto program = std::exchange(pending->program, 0);
+        if (!pending->cached) {
+            // NOTE(panmar): The first status query waits for the driver to
+            // finish, unless `is_ready` already reported completion
+            log_shader_errors_if_any(pending->vs, vs_files);
+            log_shader_errors_if_any(pending->fs, fs_files);
+            log_program_errors_if_any(program);
+            ShaderBinaryCache::store(program, pending->cache_key);
+
+            for (auto shader : {pending->vs, pending->fs}) {
+                if (shader) {
+                    glDetachShader(program, shader);
+                }
+            }
+        }
+
+        std::chrono::duration<f32, std::milli> elapsed =
+            std::chrono::high_resolution_clock::now() - start;
+        auto elapsed_ms = pending->submit_ms + elapsed.count();
+        if (pending->cached) {
+            ShaderBinaryCache::record_load(elapsed_ms);
+        } else {
+            ShaderBinaryCache::record_compile(elapsed_ms);
+        }
+        pending.reset();
+
+        // NOTE(panmar): Stages get half of the texture units each, vertex
+        // stages the upper half, so they do not collide with the stage they
+        // are combined with
+        constexpr i32 stage_samplers = ShaderReflection::MAX_SAMPLERS / 2;
+        auto first_sampler_unit =
+            stage == GL_VERTEX_SHADER ? stage_samplers : 0;
+        auto max_samplers =
+            stage ? stage_samplers
+                  : static_cast<i32>(ShaderReflection::MAX_SAMPLERS);
+        _reflection = ShaderReflection::reflect(program, first_sampler_unit,
+                                                max_samplers);
+        ++generation;
+
+        auto store_block = glGetUniformBlockIndex(program, "Store");
+        if (store_block != GL_INVALID_INDEX) {
+            glUniformBlockBinding(program, store_block, STORE_BLOCK_BINDING);
+        }
+        uniform_shadows.assign(_reflection.location_count, {});
 
         auto compute_label = [](const Path& vs_path,
                                 const Path& fs_path) -> string {
+            // NOTE(panmar): Stage programs are labeled by their file
             if (vs_path.empty() || fs_path.empty()) {
-                return "";
+                return (vs_path.empty() ? fs_path : vs_path)
+                    .filename()
+                    .string();
             }
 
             if (vs_path.stem() == fs_path.stem()) {
@@ -269,6 +629,176 @@ private:
         return program;
     };
 
+    // NOTE(panmar): Compile and link calls only queue work in the driver; no
+    // status is queried here
+    void compile_and_link(PendingProgram& pending) const {
+        auto compile = [](u32 type, const string& text) {
+            auto shader = glCreateShader(type);
+            const char* cstr = text.c_str();
+            glShaderSource(shader, 1, &cstr, nullptr);
+            glCompileShader(shader);
+            return shader;
+        };
+
+        // NOTE(panmar): Stage programs have only one of the sources
+        auto program = pending.program;
+        if (stage != GL_FRAGMENT_SHADER) {
+            pending.vs = compile(GL_VERTEX_SHADER, vs_text);
+            glAttachShader(program, pending.vs);
+        }
+        if (stage != GL_VERTEX_SHADER) {
+            pending.fs = compile(GL_FRAGMENT_SHADER, fs_text);
+            glAttachShader(program, pending.fs);
+        }
+        glBindAttribLocation(program, INPUT_POSITION_LOCATION,
+                             INPUT_POSITION_ATTRIB);
+        glBindAttribLocation(program, INPUT_NORMAL_LOCATION,
+                             INPUT_NORMAL_ATTRIB);
+        glBindAttribLocation(program, INPUT_TEXCOORD_LOCATION,
+                             INPUT_TEXCOORD_ATTRIB);
+        glBindAttribLocation(program, INPUT_INSTANCE_WORLD_LOCATION,
+                             INPUT_INSTANCE_WORLD_ATTRIB);
+        glBindAttribLocation(program, INPUT_INSTANCE_COLOR_LOCATION,
+                             INPUT_INSTANCE_COLOR_ATTRIB);
+        for (u32 i = 0; i < MAX_INSTANCE_DATA; ++i) {
+            glBindAttribLocation(program, INPUT_INSTANCE_DATA_LOCATION + i,
+                                 INPUT_INSTANCE_DATA_ATTRIBS[i]);
+        }
+        ShaderBinaryCache::prepare(program);
+        glLinkProgram(program);
+    }
+
+    u32 create_pipeline() const {
+        u32 pipeline = 0;
+        glCreateProgramPipelines(1, &pipeline);
+        use_pipeline_stages(pipeline);
+
+        debug::label(fmt::format("{}:{}", vs_path.stem().string(),
+                                 fs_path.stem().string()),
+                     GL_PROGRAM_PIPELINE, pipeline);
+        return pipeline;
+    }
+
+    void use_pipeline_stages(u32 pipeline) const {
+        glUseProgramStages(pipeline, GL_VERTEX_SHADER_BIT,
+                           vertex_stage->resource());
+        glUseProgramStages(pipeline, GL_FRAGMENT_SHADER_BIT,
+                           fragment_stage->resource());
+        stage_generations = {vertex_stage->generation,
+                             fragment_stage->generation};
+        _reflection = ShaderReflection::merge(vertex_stage->_reflection,
+                                              fragment_stage->_reflection);
+    }
+
+    // NOTE(panmar): Stages are rebuilt on their own when their sources
+    // change; the pipeline picks up the new programs when it is next used
+    void sync_pipeline_stages() const {
+        auto pipeline = resource();
+        vertex_stage->resource();
+        fragment_stage->resource();
+        if (stage_generations[0] != vertex_stage->generation ||
+            stage_generations[1] != fragment_stage->generation) {
+            use_pipeline_stages(pipeline);
+        }
+    }
+
+    template <class ParamType>
+    const Shader& pipeline_param(const char* name,
+                                 const ParamType& value) const {
+        sync_pipeline_stages();
+        auto found = false;
+        for (auto stage : {vertex_stage, fragment_stage}) {
+            if (stage->_reflection.uniform_element(name)) {
+                stage->param(name, value);
+                found = true;
+            }
+        }
+
+        if (!found) {
+            ++current_stats.location_misses;
+            throw_param_error(name, "could not be found");
+        }
+        return *this;
+    }
+
+    // NOTE(panmar): Text shaders keep their text; returns the source hash
+    u64 load_source(const Path& path, string& text,
+                    vector<Path>& files) const {
+        if (path.empty()) {
+            return shader_source_hash(text);
+        }
+
+        if (!preprocessor) {
+            text = read_file(path);
+            files = {path};
+            return shader_source_hash(text);
+        }
+
+        auto& source = preprocessor->expand(path);
+        text = source.text;
+        files = source.files;
+        return source.hash;
+    }
+
+    // NOTE(panmar): `#line` keeps the line numbers of the file after it
+    void inject_prelude(string& text) const {
+        if (prelude.empty()) {
+            return;
+        }
+
+        auto version = text.find("#version");
+        auto line_end = version == string::npos ? string::npos
+                                                : text.find('\n', version);
+        if (line_end == string::npos) {
+            text = prelude + "#line 1 0\n" + text;
+            return;
+        }
+
+        auto line = std::count(text.begin(), text.begin() + line_end, '\n');
+        text.insert(line_end + 1,
+                    prelude + fmt::format("#line {} 0\n", line + 2));
+    }
+
+    // NOTE(panmar): The block spans several lines, so it is followed by a
+    // `#line` restoring the numbering of the line after the pragma
+    static bool inject_store_block(string& text) {
+        auto pragma = text.find(STORE_BLOCK_PRAGMA);
+        if (pragma == string::npos) {
+            return false;
+        }
+
+        auto [line, source] = source_line(text, pragma);
+        text.replace(pragma, std::strlen(STORE_BLOCK_PRAGMA),
+                     store_block_declaration +
+                         fmt::format("#line {} {}", line + 1, source));
+        return true;
+    }
+
+    // NOTE(panmar): Line and source string number of `position`, following
+    // the last `#line` directive before it
+    static std::pair<u32, u32> source_line(const string& text,
+                                           size_t position) {
+        u32 line = 1;
+        u32 source = 0;
+        size_t counted_from = 0;
+
+        auto directive = text.rfind("#line ", position);
+        while (directive != string::npos && directive != 0 &&
+               text[directive - 1] != '\n') {
+            directive = text.rfind("#line ", directive - 1);
+        }
+        if (directive != string::npos) {
+            char* end = nullptr;
+            line = std::strtoul(text.c_str() + directive + 6, &end, 10);
+            source = std::strtoul(end, nullptr, 10);
+            counted_from = text.find('\n', directive) + 1;
+        }
+
+        line += static_cast<u32>(std::count(text.begin() + counted_from,
+                                            text.begin() + position, '\n'));
+        return {line, source};
+    }
+
     static void shader_resource_deleter(u32& resource) {
         if (resource) {
             glDeleteProgram(resource);
@@ -276,7 +806,21 @@ private:
         }
     }
 
-    bool log_shader_errors_if_any(u32 shader) const {
+    static void pipeline_resource_deleter(u32& resource) {
+        if (resource) {
+            glDeleteProgramPipelines(1, &resource);
+            resource = 0;
+        }
+    }
+
+    // NOTE(panmar): Errors are reported by glsl source string number, so the
+    // files behind the numbers are listed as well
+    bool log_shader_errors_if_any(u32 shader,
+                                  const vector<Path>& files) const {
+        if (!shader) {
+            return true;
+        }
+
         char message[1024];
         i32 success = 0;
         glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
@@ -284,6 +828,9 @@ private:
             glGetShaderInfoLog(shader, 1024, nullptr, message);
             printf("Shader compilation error:\n");
             printf("%s\n", message);
+            for (u32 i = 0; i < files.size(); ++i) {
+                printf("  source %u: %s\n", i, files[i].string().c_str());
+            }
         }
         return success != 0;
     }
@@ -302,9 +849,39 @@ private:
 
     const Path vs_path;
     const Path fs_path;
+    ShaderPreprocessor* preprocessor = nullptr;
+    const string prelude;
+
+    // NOTE(panmar): Set for stage programs
+    u32 stage = 0;
+    // NOTE(panmar): Set for pipelines
+    const Shader* vertex_stage = nullptr;
+    const Shader* fragment_stage = nullptr;
+    mutable array<u32, 2> stage_generations = {};
+    // NOTE(panmar): Bumped whenever the program is (re)created
+    mutable u32 generation = 0;
     mutable string vs_text;
     mutable string fs_text;
+    mutable u64 vs_hash = 0;
+    mutable u64 fs_hash = 0;
+    mutable vector<Path> vs_files;
+    mutable vector<Path> fs_files;
 
     mutable bool bound = false;
-    mutable u32 current_sampler_slot = 0;
+
+    struct UniformShadow {
+        array<u8, sizeof(mat4)> data = {};
+        u32 size = 0;
+    };
+
+    mutable unique_ptr<PendingProgram> pending;
+    mutable ShaderReflection _reflection;
+    mutable vector<UniformShadow> uniform_shadows;
+    mutable vector<StoreBinding> _store_bindings;
+    mutable u32 store_bindings_program = 0;
+    mutable const Store* store_bindings_store = nullptr;
+    mutable u64 store_bindings_version = 0;
+
+    static inline UniformStats current_stats;
+    static inline UniformStats last_frame_stats;
 };
\ No newline at end of file
@@ -0,0 +1,207 @@
+#pragma once
+
+#include <chrono>
+#include <fstream>
+
+#include <glad/glad.h>
+#define GLFW_INCLUDE_GLU
+#include <GLFW/glfw3.h>
+
+#include "meow_hash.h"
+
+#include "common.h"
+#include "config.h"
+#include "graphics/shader_preprocessor.h"
+
+struct ShaderBinaryCacheStats {
+    u32 loaded = 0;
+    u32 compiled = 0;
+    // NOTE(panmar): Cached binaries the driver refused, e.g. after a driver
+    // update; those programs were compiled again
+    u32 rejected = 0;
+    f32 load_ms = 0.f;
+    f32 compile_ms = 0.f;
+};
+
+// NOTE(panmar): Linked programs are stored on disk with glGetProgramBinary and
+// restored with glProgramBinary, which skips compiling and linking on later
+// runs. A binary is keyed by the source hashes of the expanded vs and fs (see
+// shader_preprocessor.h) and of the text injected into them, together with the
+// driver vendor, renderer and version, so an edited shader or a different
+// driver just misses. Drivers may still reject a binary they produced, in
+// which case the caller compiles from source.
+//
+// File layout: magic, cache version, binary format, binary length, binary.
+class ShaderBinaryCache {
+public:
+    using Key = u64;
+
+    // NOTE(panmar): `injected_hash` covers the text injected into the
+    // expanded sources (variant defines, the Store block); 0 if none
+    static Key key(u64 vs_hash, u64 fs_hash, u64 injected_hash) {
+        meow_state state;
+        MeowBegin(&state, MeowDefaultSeed);
+
+        auto& signature = driver_signature();
+        MeowAbsorb(&state, signature.size(), (void*)signature.data());
+        MeowAbsorb(&state, sizeof(vs_hash), &vs_hash);
+        MeowAbsorb(&state, sizeof(fs_hash), &fs_hash);
+        MeowAbsorb(&state, sizeof(injected_hash), &injected_hash);
+
+        auto hash128 = MeowEnd(&state, nullptr);
+        return MeowU64From(hash128, 0);
+    }
+
+    // NOTE(panmar): Returns false if there is no usable binary, the program
+    // is then left unlinked
+    static bool load(u32 program, Key key) {
+        if (!config::shader_binary_cache) {
+            return false;
+        }
+
+        auto path = path_of(key);
+        std::ifstream ifs(path, std::ios::binary);
+        if (!ifs) {
+            return false;
+        }
+
+        Header header;
+        ifs.read(reinterpret_cast<char*>(&header), sizeof(header));
+        if (!ifs || header.magic != MAGIC || header.version != VERSION) {
+            discard(path);
+            return false;
+        }
+
+        // NOTE(panmar): The length is checked against the file before
+        // allocating, so a corrupt header can not request gigabytes
+        std::error_code error;
+        auto file_size = std::filesystem::file_size(path, error);
+        if (error || file_size != sizeof(header) + u64{header.length}) {
+            ifs.close();
+            discard(path);
+            return false;
+        }
+
+        vector<u8> binary(header.length);
+        ifs.read(reinterpret_cast<char*>(binary.data()), binary.size());
+        if (!ifs) {
+            discard(path);
+            return false;
+        }
+
+        glProgramBinary(program, header.format, binary.data(),
+                        static_cast<i32>(binary.size()));
+
+        i32 success = 0;
+        glGetProgramiv(program, GL_LINK_STATUS, &success);
+        if (!success) {
+            ++current_stats.rejected;
+            discard(path);
+            return false;
+        }
+        return true;
+    }
+
+    // NOTE(panmar): Call before linking a program that is going to be stored
+    static void prepare(u32 program) {
+        if (config::shader_binary_cache) {
+            glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT,
+                                GL_TRUE);
+        }
+    }
+
+    static void store(u32 program, Key key) {
+        if (!config::shader_binary_cache) {
+            return;
+        }
+
+        i32 linked = 0;
+        i32 length = 0;
+        glGetProgramiv(program, GL_LINK_STATUS, &linked);
+        glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+        if (!linked || length <= 0) {
+            return;
+        }
+
+        Header header;
+        vector<u8> binary(length);
+        glGetProgramBinary(program, length, nullptr, &header.format,
+                           binary.data());
+        header.length = length;
+
+        // NOTE(panmar): The cache is an optimization; failing to write it is
+        // not an error
+        std::error_code error;
+        std::filesystem::create_directories(config::shader_binary_cache_dir,
+                                            error);
+        auto path = path_of(key);
+        auto temporary = Path(path).concat(".tmp");
+        {
+            std::ofstream ofs(temporary, std::ios::binary | std::ios::trunc);
+            ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            ofs.write(reinterpret_cast<const char*>(binary.data()),
+                      binary.size());
+            if (!ofs) {
+                ofs.close();
+                discard(temporary);
+                return;
+            }
+        }
+        // NOTE(panmar): Renamed into place, so a crash never leaves a
+        // truncated binary behind
+        std::filesystem::rename(temporary, path, error);
+        if (error) {
+            discard(temporary);
+        }
+    }
+
+    static void record_load(f32 ms) {
+        ++current_stats.loaded;
+        current_stats.load_ms += ms;
+    }
+
+    static void record_compile(f32 ms) {
+        ++current_stats.compiled;
+        current_stats.compile_ms += ms;
+    }
+
+    // NOTE(panmar): Totals since startup
+    static const ShaderBinaryCacheStats& stats() { return current_stats; }
+
+private:
+    struct Header {
+        u32 magic = MAGIC;
+        u32 version = VERSION;
+        u32 format = 0;
+        u32 length = 0;
+    };
+
+    static constexpr u32 MAGIC = 0x42475050;  // "PPGB"
+    // NOTE(panmar): Bump when the program setup before linking changes
+    // (e.g. attribute locations), which is not part of the key
+    static constexpr u32 VERSION = 1;
+
+    static const string& driver_signature() {
+        static const string signature = [] {
+            auto get = [](u32 name) -> string {
+                auto value = glGetString(name);
+                return value ? reinterpret_cast<const char*>(value) : "";
+            };
+            return fmt::format("{}|{}|{}", get(GL_VENDOR), get(GL_RENDERER),
+                               get(GL_VERSION));
+        }();
+        return signature;
+    }
+
+    static Path path_of(Key key) {
+        return Path(config::shader_binary_cache_dir) /
+               fmt::format("{:016x}.bin", key);
+    }
+
+    static void discard(const Path& path) {
+        std::error_code error;
+        std::filesystem::remove(path, error);
+    }
+
+    static inline ShaderBinaryCacheStats current_stats;
+};
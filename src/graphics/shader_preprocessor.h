@@ -0,0 +1,179 @@
+#pragma once
+
+#include <functional>
+
+#include "meow_hash.h"
+
+#include "common.h"
+
+// NOTE(panmar): The hash every cache keyed on shader source uses, computed
+// over the text after includes were expanded
+inline u64 shader_source_hash(std::string_view text) {
+    meow_state state;
+    MeowBegin(&state, MeowDefaultSeed);
+    u64 size = text.size();
+    MeowAbsorb(&state, sizeof(size), &size);
+    if (size) {
+        MeowAbsorb(&state, size, (void*)text.data());
+    }
+    auto hash128 = MeowEnd(&state, nullptr);
+    return MeowU64From(hash128, 0);
+}
+
+struct ShaderPathHash {
+    size_t operator()(const Path& path) const {
+        return std::filesystem::hash_value(path);
+    }
+};
+
+using ShaderPathSet = unordered_set<Path, ShaderPathHash>;
+
+// NOTE(panmar): A shader file with its includes pasted in. Every file gets a
+// glsl source string number, its index in `files`, and the expansion is
+// marked with `#line` directives, so compile errors report `index(line)` of
+// the file they are in.
+struct ExpandedShaderSource {
+    string text;
+    u64 hash = 0;
+    vector<Path> files;
+};
+
+// NOTE(panmar): Resolves lines of the form
+//
+//     #include "name.glsl"
+//
+// against the content resource index, by file name. A file is included only
+// once per expansion, which also makes include cycles harmless. Expansions
+// are cached until one of the files they were built from changes on disk.
+class ShaderPreprocessor {
+public:
+    using Resolver = std::function<Path(const string&)>;
+
+    ShaderPreprocessor(Resolver resolver) : resolver(std::move(resolver)) {}
+
+    const ExpandedShaderSource& expand(const Path& path) {
+        auto it = expansions.find(path);
+        if (it != expansions.end()) {
+            return it->second;
+        }
+
+        ExpandedShaderSource result;
+        ShaderPathSet included;
+        expand_file(path, result, included);
+        result.hash = shader_source_hash(result.text);
+
+        for (auto& file : result.files) {
+            dependents[file].insert(path);
+        }
+        return expansions.insert({path, std::move(result)}).first->second;
+    }
+
+    // NOTE(panmar): Drops cached files modified since they were read, and
+    // the expansions depending on them; returns the shader files that have
+    // to be expanded again
+    ShaderPathSet invalidate_changed() {
+        ShaderPathSet affected;
+        for (auto it = files.begin(); it != files.end();) {
+            std::error_code error;
+            auto time = std::filesystem::last_write_time(it->first, error);
+            if (!error && time == it->second.write_time) {
+                ++it;
+                continue;
+            }
+
+            auto& roots = dependents[it->first];
+            for (auto& root : roots) {
+                affected.insert(root);
+                expansions.erase(root);
+            }
+            roots.clear();
+            it = files.erase(it);
+        }
+        return affected;
+    }
+
+private:
+    struct File {
+        string text;
+        std::filesystem::file_time_type write_time;
+    };
+
+    static constexpr std::string_view INCLUDE_DIRECTIVE = "#include";
+
+    const string& read(const Path& path) {
+        auto it = files.find(path);
+        if (it != files.end()) {
+            return it->second.text;
+        }
+
+        File file;
+        std::error_code error;
+        file.write_time = std::filesystem::last_write_time(path, error);
+        file.text = read_file(path);
+        return files.insert({path, std::move(file)}).first->second.text;
+    }
+
+    void expand_file(const Path& path, ExpandedShaderSource& result,
+                     ShaderPathSet& included) {
+        included.insert(path);
+        auto index = result.files.size();
+        result.files.push_back(path);
+
+        auto& text = read(path);
+        u32 line_number = 1;
+        for (size_t begin = 0; begin < text.size(); ++line_number) {
+            auto end = text.find('\n', begin);
+            end = end == string::npos ? text.size() : end + 1;
+            auto line = std::string_view(text).substr(begin, end - begin);
+            begin = end;
+
+            auto name = include_name(line, path, line_number);
+            if (!name) {
+                result.text += line;
+                if (line.back() != '\n') {
+                    result.text += '\n';
+                }
+                continue;
+            }
+
+            auto include_path = resolver(*name);
+            if (included.count(include_path)) {
+                // NOTE(panmar): Keeps line numbers of the file in sync
+                result.text += '\n';
+                continue;
+            }
+
+            result.text += fmt::format("#line 1 {}\n", result.files.size());
+            expand_file(include_path, result, included);
+            result.text +=
+                fmt::format("#line {} {}\n", line_number + 1, index);
+        }
+    }
+
+    static optional<string> include_name(std::string_view line,
+                                         const Path& path, u32 line_number) {
+        auto start = line.find_first_not_of(" \t");
+        if (start == std::string_view::npos ||
+            line.substr(start, INCLUDE_DIRECTIVE.size()) != INCLUDE_DIRECTIVE) {
+            return std::nullopt;
+        }
+
+        auto open = line.find('"', start + INCLUDE_DIRECTIVE.size());
+        auto close = open == std::string_view::npos
+                         ? std::string_view::npos
+                         : line.find('"', open + 1);
+        if (close == std::string_view::npos || close == open + 1) {
+            throw PlayGlException(fmt::format("{}({}): Malformed #include",
+                                              path.filename().string(),
+                                              line_number));
+        }
+        return string(line.substr(open + 1, close - open - 1));
+    }
+
+    Resolver resolver;
+    unordered_map<Path, File, ShaderPathHash> files;
+    unordered_map<Path, ExpandedShaderSource, ShaderPathHash> expansions;
+    // NOTE(panmar): Reverse include graph: file -> shader files expanded
+    // from it, the file itself included
+    unordered_map<Path, ShaderPathSet, ShaderPathHash> dependents;
+};
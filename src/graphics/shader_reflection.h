@@ -0,0 +1,312 @@
+#pragma once
+
+#include <glad/glad.h>
+#define GLFW_INCLUDE_GLU
+#include <GLFW/glfw3.h>
+
+#include "common.h"
+
+// NOTE(panmar): FNV-1a; program resources are looked up by hash, so a lookup
+// neither allocates nor compares strings
+constexpr u64 uniform_name_hash(std::string_view name) {
+    u64 hash = 14695981039346656037ull;
+    for (auto c : name) {
+        hash = (hash ^ static_cast<u8>(c)) * 1099511628211ull;
+    }
+    return hash;
+}
+
+// NOTE(panmar): The interface of a linked program, queried once through the
+// program interface api and never changed afterwards
+struct ShaderReflection {
+    static constexpr u32 MAX_SAMPLERS = 16;
+
+    struct Uniform {
+        string name;
+        u32 type = 0;
+        i32 location = -1;
+        i32 array_size = 1;
+        // NOTE(panmar): Texture unit assigned at link time, -1 for
+        // non-sampler uniforms
+        i32 sampler_unit = -1;
+    };
+
+    // NOTE(panmar): A uniform, or one element of an array uniform
+    struct UniformElement {
+        const Uniform* uniform = nullptr;
+        i32 index = 0;
+
+        explicit operator bool() const { return uniform != nullptr; }
+
+        i32 location() const { return uniform->location + index; }
+
+        i32 sampler_unit() const {
+            return uniform->sampler_unit == -1 ? -1
+                                               : uniform->sampler_unit + index;
+        }
+    };
+
+    struct Block {
+        string name;
+        i32 binding = -1;
+        i32 size = 0;
+    };
+
+    struct Input {
+        string name;
+        u32 type = 0;
+        i32 location = -1;
+        i32 array_size = 1;
+    };
+
+    // NOTE(panmar): Only uniforms of the default block, which have locations
+    vector<Uniform> uniforms;
+    vector<Block> uniform_blocks;
+    vector<Block> storage_blocks;
+    vector<Input> inputs;
+
+    // NOTE(panmar): One past the largest uniform location
+    i32 location_count = 0;
+
+    const Uniform* uniform(std::string_view name) const {
+        return find(uniform_indices, uniforms, name);
+    }
+
+    // NOTE(panmar): Also resolves `name[N]`, bounds-checked against the
+    // array size of `name`
+    UniformElement uniform_element(std::string_view name) const {
+        if (auto found = uniform(name)) {
+            return {found, 0};
+        }
+
+        auto open = name.rfind('[');
+        if (open == std::string_view::npos || name.back() != ']' ||
+            open + 2 >= name.size()) {
+            return {};
+        }
+
+        i32 index = 0;
+        for (auto c : name.substr(open + 1, name.size() - open - 2)) {
+            if (c < '0' || c > '9' || index > MAX_ARRAY_INDEX) {
+                return {};
+            }
+            index = index * 10 + (c - '0');
+        }
+
+        auto found = uniform(name.substr(0, open));
+        if (!found || index >= found->array_size) {
+            return {};
+        }
+        return {found, index};
+    }
+
+    const Input* input(std::string_view name) const {
+        return find(input_indices, inputs, name);
+    }
+
+    static bool is_sampler(u32 type) {
+        switch (type) {
+            case GL_SAMPLER_1D:
+            case GL_SAMPLER_2D:
+            case GL_SAMPLER_3D:
+            case GL_SAMPLER_CUBE:
+            case GL_SAMPLER_1D_SHADOW:
+            case GL_SAMPLER_2D_SHADOW:
+            case GL_SAMPLER_1D_ARRAY:
+            case GL_SAMPLER_2D_ARRAY:
+            case GL_SAMPLER_2D_ARRAY_SHADOW:
+            case GL_SAMPLER_2D_MULTISAMPLE:
+            case GL_SAMPLER_2D_MULTISAMPLE_ARRAY:
+            case GL_SAMPLER_CUBE_SHADOW:
+            case GL_SAMPLER_BUFFER:
+            case GL_SAMPLER_2D_RECT:
+            case GL_SAMPLER_2D_RECT_SHADOW:
+            case GL_INT_SAMPLER_2D:
+            case GL_INT_SAMPLER_3D:
+            case GL_INT_SAMPLER_CUBE:
+            case GL_INT_SAMPLER_2D_ARRAY:
+            case GL_UNSIGNED_INT_SAMPLER_2D:
+            case GL_UNSIGNED_INT_SAMPLER_3D:
+            case GL_UNSIGNED_INT_SAMPLER_CUBE:
+            case GL_UNSIGNED_INT_SAMPLER_2D_ARRAY:
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    // NOTE(panmar): Samplers get consecutive texture units starting at
+    // `first_sampler_unit`; more than `max_samplers` of them is an error
+    static ShaderReflection reflect(u32 program, i32 first_sampler_unit = 0,
+                                    i32 max_samplers = MAX_SAMPLERS) {
+        ShaderReflection result;
+
+        auto resource_count = [program](u32 interface) {
+            i32 count = 0;
+            glGetProgramInterfaceiv(program, interface, GL_ACTIVE_RESOURCES,
+                                    &count);
+            return count;
+        };
+
+        auto resource_name = [program](u32 interface, u32 index) {
+            i32 length = 0;
+            constexpr u32 property = GL_NAME_LENGTH;
+            glGetProgramResourceiv(program, interface, index, 1, &property, 1,
+                                   nullptr, &length);
+
+            string name(std::max(length, 1), '\0');
+            glGetProgramResourceName(program, interface, index, length,
+                                     nullptr, name.data());
+            name.resize(std::max(length - 1, 0));
+            return name;
+        };
+
+        i32 sampler_unit = first_sampler_unit;
+        for (i32 i = 0, count = resource_count(GL_UNIFORM); i < count; ++i) {
+            constexpr u32 properties[] = {GL_BLOCK_INDEX, GL_TYPE, GL_LOCATION,
+                                          GL_ARRAY_SIZE};
+            i32 values[4] = {};
+            glGetProgramResourceiv(program, GL_UNIFORM, i, 4, properties, 4,
+                                   nullptr, values);
+            if (values[0] != -1 || values[2] == -1) {
+                continue;
+            }
+
+            Uniform uniform;
+            uniform.name = resource_name(GL_UNIFORM, i);
+            uniform.type = values[1];
+            uniform.location = values[2];
+            uniform.array_size = std::max(values[3], 1);
+
+            // NOTE(panmar): Array uniforms are reported as `name[0]`
+            auto array_suffix = uniform.name.rfind("[0]");
+            if (array_suffix != string::npos &&
+                array_suffix + 3 == uniform.name.size()) {
+                uniform.name.resize(array_suffix);
+            }
+
+            if (is_sampler(uniform.type)) {
+                if (sampler_unit + uniform.array_size >
+                    first_sampler_unit + max_samplers) {
+                    throw PlayGlException("Number of samplers exceeded");
+                }
+
+                uniform.sampler_unit = sampler_unit;
+                for (i32 j = 0; j < uniform.array_size; ++j) {
+                    glProgramUniform1i(program, uniform.location + j,
+                                       sampler_unit++);
+                }
+            }
+
+            result.location_count =
+                std::max(result.location_count,
+                         uniform.location + uniform.array_size);
+            result.uniform_indices[uniform_name_hash(uniform.name)] =
+                result.uniforms.size();
+            result.uniforms.push_back(std::move(uniform));
+        }
+
+        auto reflect_blocks = [&](u32 interface, vector<Block>& blocks) {
+            for (i32 i = 0, count = resource_count(interface); i < count;
+                 ++i) {
+                constexpr u32 properties[] = {GL_BUFFER_BINDING,
+                                              GL_BUFFER_DATA_SIZE};
+                i32 values[2] = {};
+                glGetProgramResourceiv(program, interface, i, 2, properties, 2,
+                                       nullptr, values);
+                blocks.push_back(
+                    {resource_name(interface, i), values[0], values[1]});
+            }
+        };
+        reflect_blocks(GL_UNIFORM_BLOCK, result.uniform_blocks);
+        reflect_blocks(GL_SHADER_STORAGE_BLOCK, result.storage_blocks);
+
+        for (i32 i = 0, count = resource_count(GL_PROGRAM_INPUT); i < count;
+             ++i) {
+            constexpr u32 properties[] = {GL_TYPE, GL_LOCATION,
+                                          GL_ARRAY_SIZE};
+            i32 values[3] = {};
+            glGetProgramResourceiv(program, GL_PROGRAM_INPUT, i, 3, properties,
+                                   3, nullptr, values);
+
+            Input input;
+            input.name = resource_name(GL_PROGRAM_INPUT, i);
+            input.type = values[0];
+            input.location = values[1];
+            input.array_size = std::max(values[2], 1);
+
+            result.input_indices[uniform_name_hash(input.name)] =
+                result.inputs.size();
+            result.inputs.push_back(std::move(input));
+        }
+
+        return result;
+    }
+
+    // NOTE(panmar): The interface of a program pipeline; locations are those
+    // of the stage programs, so they are not unique, and a uniform declared
+    // by both stages is listed once
+    static ShaderReflection merge(const ShaderReflection& vertex,
+                                  const ShaderReflection& fragment) {
+        ShaderReflection result;
+        for (auto stage : {&vertex, &fragment}) {
+            for (auto& uniform : stage->uniforms) {
+                auto hash = uniform_name_hash(uniform.name);
+                if (!result.uniform_indices.count(hash)) {
+                    result.uniform_indices[hash] = result.uniforms.size();
+                    result.uniforms.push_back(uniform);
+                }
+            }
+            result.uniform_blocks.insert(result.uniform_blocks.end(),
+                                         stage->uniform_blocks.begin(),
+                                         stage->uniform_blocks.end());
+            result.storage_blocks.insert(result.storage_blocks.end(),
+                                         stage->storage_blocks.begin(),
+                                         stage->storage_blocks.end());
+        }
+
+        result.inputs = vertex.inputs;
+        result.input_indices = vertex.input_indices;
+        return result;
+    }
+
+private:
+    // NOTE(panmar): Keeps parsing an index from overflowing
+    static constexpr i32 MAX_ARRAY_INDEX = 1 << 24;
+
+    template <class T>
+    static const T* find(const unordered_map<u64, u32>& indices,
+                         const vector<T>& values, std::string_view name) {
+        auto it = indices.find(uniform_name_hash(name));
+        return it != indices.end() ? &values[it->second] : nullptr;
+    }
+
+    unordered_map<u64, u32> uniform_indices;
+    unordered_map<u64, u32> input_indices;
+};
+
+// NOTE(panmar): Whether a value of type T can be uploaded to a uniform of the
+// given gl type
+template <class T>
+bool uniform_type_matches(u32 type) {
+    if constexpr (std::is_same_v<T, bool> || std::is_same_v<T, i32>) {
+        return type == GL_INT || type == GL_BOOL;
+    } else if constexpr (std::is_same_v<T, f32>) {
+        return type == GL_FLOAT || type == GL_BOOL;
+    } else if constexpr (std::is_same_v<T, vec2>) {
+        return type == GL_FLOAT_VEC2;
+    } else if constexpr (std::is_same_v<T, vec3>) {
+        return type == GL_FLOAT_VEC3;
+    } else if constexpr (std::is_same_v<T, vec4> ||
+                         std::is_same_v<T, Color>) {
+        return type == GL_FLOAT_VEC4;
+    } else if constexpr (std::is_same_v<T, glm::mat2>) {
+        return type == GL_FLOAT_MAT2;
+    } else if constexpr (std::is_same_v<T, glm::mat3>) {
+        return type == GL_FLOAT_MAT3;
+    } else if constexpr (std::is_same_v<T, mat4>) {
+        return type == GL_FLOAT_MAT4;
+    } else {
+        return false;
+    }
+}
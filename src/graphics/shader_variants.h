@@ -0,0 +1,239 @@
+#pragma once
+
+#include <set>
+
+#include "common.h"
+#include "graphics/shader.h"
+#include "graphics/shader_preprocessor.h"
+#include "store.h"
+
+// NOTE(panmar): Keys `#define`d in a program variant
+using ShaderDefines = std::set<string>;
+
+// NOTE(panmar): The programs built from one vs/fs pair and set of defines.
+// Store params annotated with `StoreParam::Specialize` that the (expanded)
+// sources mention are baked in as
+//
+//     #define NAME value
+//
+// so there is one program per combination of their values, and a branch on
+// them is resolved by the compiler instead of per fragment. Only int, float
+// and vector params can be specialized; ints can be tested with `#if`.
+//
+// A new variant is compiled in the background; until it is ready the last
+// ready variant is drawn with. Variants for the other values of bounded int
+// params (toggles) are compiled ahead, so switching them is instant.
+class ShaderVariants {
+public:
+    // NOTE(panmar): `base` is the program without defines, used as long as
+    // nothing is specialized
+    ShaderVariants(const Path& vs_path, const Path& fs_path,
+                   const ShaderDefines& defines,
+                   ShaderPreprocessor& preprocessor, Shader* base)
+        : vs_path(vs_path),
+          fs_path(fs_path),
+          preprocessor(&preprocessor),
+          base(base) {
+        for (auto& define : defines) {
+            defines_prelude += fmt::format("#define {}\n", define);
+        }
+    }
+
+    Shader& select(Store& store) {
+        if (store_version != store.version()) {
+            collect_specialized(store);
+        }
+
+        if (values_changed()) {
+            current = &variant(prelude());
+            precompile_toggles();
+        }
+
+        if (current->is_ready()) {
+            last_ready = current;
+            return *current;
+        }
+        return last_ready ? *last_ready : *current;
+    }
+
+    u32 reload_if_changed(const ShaderPathSet& changed) {
+        u32 reloaded = 0;
+        for (auto& [key, shader] : variants) {
+            reloaded += shader.reload_if_changed(changed);
+        }
+        return reloaded;
+    }
+
+private:
+    struct Specialized {
+        string name;
+        const StoreParam* param = nullptr;
+        StoreParam::ParamType value;
+    };
+
+    // NOTE(panmar): Toggles with more values than this are compiled on demand
+    static constexpr i32 MAX_PRECOMPILED_VALUES = 8;
+
+    static optional<string> glsl_literal(const StoreParam::ParamType& value) {
+        return std::visit(
+            [](auto&& arg) -> optional<string> {
+                using T = std::decay_t<decltype(arg)>;
+                if constexpr (std::is_same_v<T, i32>) {
+                    return fmt::format("{}", arg);
+                } else if constexpr (std::is_same_v<T, f32>) {
+                    return fmt::format("float({:.9g})", arg);
+                } else if constexpr (std::is_same_v<T, vec3>) {
+                    return fmt::format("vec3({:.9g}, {:.9g}, {:.9g})", arg.x,
+                                       arg.y, arg.z);
+                } else if constexpr (std::is_same_v<T, vec4>) {
+                    return fmt::format("vec4({:.9g}, {:.9g}, {:.9g}, {:.9g})",
+                                       arg.x, arg.y, arg.z, arg.w);
+                } else if constexpr (std::is_same_v<T, Color>) {
+                    return fmt::format("vec4({:.9g}, {:.9g}, {:.9g}, {:.9g})",
+                                       arg.data[0], arg.data[1], arg.data[2],
+                                       arg.data[3]);
+                } else {
+                    return std::nullopt;
+                }
+            },
+            value);
+    }
+
+    static bool same_value(const StoreParam::ParamType& lhs,
+                           const StoreParam::ParamType& rhs) {
+        if (lhs.index() != rhs.index()) {
+            return false;
+        }
+
+        return std::visit(
+            [&rhs](auto&& arg) {
+                using T = std::decay_t<decltype(arg)>;
+                auto& other = std::get<T>(rhs);
+                if constexpr (std::is_same_v<T, string>) {
+                    return arg == other;
+                } else {
+                    return std::memcmp(&arg, &other, sizeof(T)) == 0;
+                }
+            },
+            lhs);
+    }
+
+    static bool mentions(const string& text, const string& name) {
+        auto is_identifier = [](char c) {
+            return std::isalnum(static_cast<u8>(c)) || c == '_';
+        };
+
+        for (auto at = text.find(name); at != string::npos;
+             at = text.find(name, at + 1)) {
+            auto end = at + name.size();
+            if ((at == 0 || !is_identifier(text[at - 1])) &&
+                (end == text.size() || !is_identifier(text[end]))) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void collect_specialized(Store& store) {
+        auto& vs_text = preprocessor->expand(vs_path).text;
+        auto& fs_text = preprocessor->expand(fs_path).text;
+
+        specialized.clear();
+        for (auto& [name, param] : store) {
+            if (param.has(StoreParam::Specialize) &&
+                glsl_literal(param.param) &&
+                (mentions(vs_text, name) || mentions(fs_text, name))) {
+                specialized.push_back({name, &param, {}});
+            }
+        }
+
+        // NOTE(panmar): Sorted, so the prelude does not depend on the order
+        // of the store's hash map
+        std::sort(specialized.begin(), specialized.end(),
+                  [](auto& lhs, auto& rhs) { return lhs.name < rhs.name; });
+
+        store_version = store.version();
+        current = nullptr;
+    }
+
+    bool values_changed() {
+        auto changed = current == nullptr;
+        for (auto& entry : specialized) {
+            if (!same_value(entry.value, entry.param->param)) {
+                entry.value = entry.param->param;
+                changed = true;
+            }
+        }
+        return changed;
+    }
+
+    // NOTE(panmar): The current values, with the value of `specialized[index]`
+    // replaced by `value` if given
+    string prelude(u32 index = 0, optional<i32> value = std::nullopt) const {
+        auto result = defines_prelude;
+        for (u32 i = 0; i < specialized.size(); ++i) {
+            // NOTE(panmar): A param that changed to a type that can not be
+            // specialized is left undefined
+            auto literal = value && i == index
+                               ? fmt::format("{}", *value)
+                               : glsl_literal(specialized[i].value);
+            if (literal) {
+                result += fmt::format("#define {} {}\n", specialized[i].name,
+                                      *literal);
+            }
+        }
+        return result;
+    }
+
+    Shader& variant(const string& prelude) {
+        if (prelude.empty() && base) {
+            return *base;
+        }
+
+        auto key = shader_source_hash(prelude);
+        auto it = variants.find(key);
+        if (it == variants.end()) {
+            it = variants
+                     .insert({key, Shader::from_file(vs_path, fs_path,
+                                                     preprocessor, prelude)})
+                     .first;
+            it->second.compile_async();
+        }
+        return it->second;
+    }
+
+    void precompile_toggles() {
+        for (u32 i = 0; i < specialized.size(); ++i) {
+            auto param = specialized[i].param;
+            auto value = std::get_if<i32>(&specialized[i].value);
+            if (!value || !param->has(StoreParam::Bounded)) {
+                continue;
+            }
+
+            auto min = static_cast<i32>(std::ceil(param->min_bound));
+            auto max = static_cast<i32>(std::floor(param->max_bound));
+            if (max - min + 1 > MAX_PRECOMPILED_VALUES) {
+                continue;
+            }
+
+            for (auto other = min; other <= max; ++other) {
+                if (other != *value) {
+                    variant(prelude(i, other)).compile_async();
+                }
+            }
+        }
+    }
+
+    Path vs_path;
+    Path fs_path;
+    ShaderPreprocessor* preprocessor;
+    Shader* base;
+    string defines_prelude;
+
+    vector<Specialized> specialized;
+    u64 store_version = std::numeric_limits<u64>::max();
+
+    unordered_map<u64, Shader> variants;
+    Shader* current = nullptr;
+    Shader* last_ready = nullptr;
+};
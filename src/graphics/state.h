@@ -4,126 +4,363 @@
 #define GLFW_INCLUDE_GLU
 #include <GLFW/glfw3.h>
 
+#include "meow_hash.h"
+
 #include "common.h"
 #include "config.h"
 
+// NOTE(panmar): All fixed function state a GpuState sets, packed into 32-bit
+// words, so blocks are compared, diffed and hashed as plain memory. Words of
+// a disabled feature (e.g. the blend func without blending) are left at
+// their defaults and are not applied.
+struct GpuStateBlock {
+    enum Word : u32 {
+        ENABLES,
+        CLIP_ORIGIN,
+        CLIP_DEPTH,
+        BLEND_SRC,
+        BLEND_DST,
+        BLEND_EQUATION,
+        BLEND_COLOR,
+        DEPTH_MASK = BLEND_COLOR + 4,
+        DEPTH_FUNC,
+        CULL_FACE,
+        POLYGON_MODE,
+        WORD_COUNT
+    };
+
+    // NOTE(panmar): Bits of the ENABLES word
+    enum Enable : u32 {
+        BLEND = 1 << 0,
+        DEPTH_TEST = 1 << 1,
+        CULL = 1 << 2,
+        MULTISAMPLE = 1 << 3,
+        ALL_ENABLES = (1 << 4) - 1
+    };
+
+    static constexpr u32 bit(Word word) { return 1u << word; }
+
+    static constexpr u32 bits(Word first, u32 count) {
+        return ((1u << count) - 1) << first;
+    }
+
+    static constexpr u32 ALL_WORDS = (1u << WORD_COUNT) - 1;
+
+    // NOTE(panmar): Bit i is set if word i differs
+    u32 diff(const GpuStateBlock& other) const {
+        u32 changed = 0;
+        for (u32 i = 0; i < WORD_COUNT; ++i) {
+            changed |= static_cast<u32>((words[i] ^ other.words[i]) != 0) << i;
+        }
+        return changed;
+    }
+
+    // NOTE(panmar): The words that are applied, see above
+    u32 used_words() const {
+        auto used = ALL_WORDS;
+        if (!(words[ENABLES] & BLEND)) {
+            used &= ~(bits(BLEND_SRC, 3) | bits(BLEND_COLOR, 4));
+        }
+        if (!(words[ENABLES] & DEPTH_TEST)) {
+            used &= ~(bit(DEPTH_MASK) | bit(DEPTH_FUNC));
+        }
+        if (!(words[ENABLES] & CULL)) {
+            used &= ~bit(CULL_FACE);
+        }
+        return used;
+    }
+
+    void set(Word word, f32 value) { std::memcpy(&words[word], &value, 4); }
+
+    f32 get_f32(Word word) const {
+        f32 value;
+        std::memcpy(&value, &words[word], 4);
+        return value;
+    }
+
+    void rehash() {
+        meow_state state;
+        MeowBegin(&state, MeowDefaultSeed);
+        MeowAbsorb(&state, sizeof(words), (void*)words.data());
+        hash = MeowU64From(MeowEnd(&state, nullptr), 0);
+    }
+
+    array<u32, WORD_COUNT> words = {};
+    u64 hash = 0;
+};
+
+// NOTE(panmar): The state last applied to GL. A block is applied by diffing
+// it against the current one and issuing only the calls of changed words.
+// After GL state was changed behind its back, call clear(), so the next
+// block is applied in full.
 class GpuStateCache {
 public:
     static void clear() {
-        enabled_flags().clear();
-        cache().clear();
+        known_words() = 0;
+        viewport_valid() = false;
+        framebuffer_valid() = false;
     }
 
-    static void glEnable(u32 flag) {
-        if (!enabled_flags().count(flag)) {
-            ::glEnable(flag);
-            enabled_flags().insert(flag);
+    static void apply(const GpuStateBlock& block) {
+        using Block = GpuStateBlock;
+
+        auto& current = applied();
+        auto& words = block.words;
+        auto used = block.used_words();
+        auto& known = known_words();
+        auto changed = (current.diff(block) | ~known) & used;
+        if (!changed) {
+            return;
         }
-    }
 
-    static void glDisable(u32 flag) {
-        if (enabled_flags().count(flag)) {
-            ::glDisable(flag);
-            enabled_flags().erase(flag);
+        if (changed & Block::bit(Block::ENABLES)) {
+            auto toggled = known & Block::bit(Block::ENABLES)
+                               ? current.words[Block::ENABLES] ^
+                                     words[Block::ENABLES]
+                               : Block::ALL_ENABLES;
+            toggle(toggled, words[Block::ENABLES]);
         }
-    }
 
-    static void glClipControl(u32 arg1, u32 arg2) {
-        if (!check_and_set(CLIP_CONTROL, arg1, arg2)) {
-            ::glClipControl(arg1, arg2);
+        if (changed & Block::bits(Block::CLIP_ORIGIN, 2)) {
+            ::glClipControl(words[Block::CLIP_ORIGIN],
+                            words[Block::CLIP_DEPTH]);
         }
-    }
 
-    static void glBlendFunc(u32 arg1, u32 arg2) {
-        if (!check_and_set(BLEND_FUNC, arg1, arg2)) {
-            ::glBlendFunc(arg1, arg2);
+        if (changed & Block::bits(Block::BLEND_SRC, 2)) {
+            ::glBlendFunc(words[Block::BLEND_SRC], words[Block::BLEND_DST]);
         }
-    }
 
-    static void glBlendEquation(u32 arg1) {
-        if (!check_and_set(BLEND_EQUATION, arg1)) {
-            ::glBlendEquation(arg1);
+        if (changed & Block::bit(Block::BLEND_EQUATION)) {
+            ::glBlendEquation(words[Block::BLEND_EQUATION]);
         }
-    }
 
-    static void glDepthMask(u32 arg1) {
-        if (!check_and_set(DEPTH_MASK, arg1)) {
-            ::glDepthMask(arg1);
+        if (changed & Block::bits(Block::BLEND_COLOR, 4)) {
+            auto color = [&block](u32 i) {
+                return block.get_f32(static_cast<Block::Word>(i));
+            };
+            ::glBlendColor(color(Block::BLEND_COLOR),
+                           color(Block::BLEND_COLOR + 1),
+                           color(Block::BLEND_COLOR + 2),
+                           color(Block::BLEND_COLOR + 3));
         }
-    }
 
-    static void glDepthFunc(u32 arg1) {
-        if (!check_and_set(DEPTH_FUNC, arg1)) {
-            ::glDepthFunc(arg1);
+        if (changed & Block::bit(Block::DEPTH_MASK)) {
+            ::glDepthMask(words[Block::DEPTH_MASK]);
         }
+
+        if (changed & Block::bit(Block::DEPTH_FUNC)) {
+            ::glDepthFunc(words[Block::DEPTH_FUNC]);
+        }
+
+        if (changed & Block::bit(Block::CULL_FACE)) {
+            ::glCullFace(words[Block::CULL_FACE]);
+        }
+
+        if (changed & Block::bit(Block::POLYGON_MODE)) {
+            ::glPolygonMode(GL_FRONT_AND_BACK, words[Block::POLYGON_MODE]);
+        }
+
+        // NOTE(panmar): Unused words keep what was last applied, so they
+        // are compared against the actual GL state later on
+        for (u32 i = 0; i < Block::WORD_COUNT; ++i) {
+            if (changed & (1u << i)) {
+                current.words[i] = words[i];
+            }
+        }
+        known |= used;
     }
 
-    static void glCullFace(u32 arg1) {
-        if (!check_and_set(CULL_FACE, arg1)) {
-            ::glCullFace(arg1);
+    static void glViewport(i32 x, i32 y, i32 width, i32 height) {
+        array<i32, 4> viewport = {x, y, width, height};
+        if (!viewport_valid() || current_viewport() != viewport) {
+            ::glViewport(x, y, width, height);
+            current_viewport() = viewport;
+            viewport_valid() = true;
         }
     }
 
-    static void glPolygonMode(u32 arg1, u32 arg2) {
-        if (!check_and_set(POLYGON_MODE, arg1, arg2)) {
-            ::glPolygonMode(arg1, arg2);
+    static void glBindFramebuffer(u32 framebuffer) {
+        if (!framebuffer_valid() || current_framebuffer() != framebuffer) {
+            ::glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+            current_framebuffer() = framebuffer;
+            framebuffer_valid() = true;
         }
     }
 
-    static void glBlendColor(f32 arg1, f32 arg2, f32 arg3, f32 arg4) {
-        if (!check_and_set(POLYGON_MODE, arg1, arg2)) {
-            ::glBlendColor(arg1, arg2, arg3, arg4);
+    // NOTE(panmar): The bound framebuffer and viewport come from the shadow
+    // copy; GL is only queried before the first bind or after clear()
+    static u32 framebuffer() {
+        if (!framebuffer_valid()) {
+            i32 framebuffer = 0;
+            glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &framebuffer);
+            current_framebuffer() = framebuffer;
+            framebuffer_valid() = true;
         }
+        return current_framebuffer();
     }
 
-    static void glViewport(f32 arg1, f32 arg2, f32 arg3, f32 arg4) {
-        if (!check_and_set(VIEWPORT, arg1, arg2)) {
-            ::glViewport(arg1, arg2, arg3, arg4);
+    static const array<i32, 4>& viewport() {
+        if (!viewport_valid()) {
+            glGetIntegerv(GL_VIEWPORT, current_viewport().data());
+            viewport_valid() = true;
         }
+        return current_viewport();
     }
 
 private:
-    enum FuncType {
-        ENABLE,
-        CLIP_CONTROL,
-        BLEND_FUNC,
-        BLEND_EQUATION,
-        DEPTH_MASK,
-        DEPTH_FUNC,
-        CULL_FACE,
-        POLYGON_MODE,
-        VIEWPORT
-    };
+    static void toggle(u32 toggled, u32 enabled) {
+        constexpr std::pair<u32, u32> capabilities[] = {
+            {GpuStateBlock::BLEND, GL_BLEND},
+            {GpuStateBlock::DEPTH_TEST, GL_DEPTH_TEST},
+            {GpuStateBlock::CULL, GL_CULL_FACE},
+            {GpuStateBlock::MULTISAMPLE, GL_MULTISAMPLE}};
+
+        for (auto [flag, capability] : capabilities) {
+            if (toggled & flag) {
+                if (enabled & flag) {
+                    ::glEnable(capability);
+                } else {
+                    ::glDisable(capability);
+                }
+            }
+        }
+    }
 
-    static unordered_set<u32>& enabled_flags() {
-        static unordered_set<u32> _enabled_flags;
-        return _enabled_flags;
+    static GpuStateBlock& applied() {
+        static GpuStateBlock _applied;
+        return _applied;
     }
 
-    using ArgType = std::variant<u32, f32>;
-    static unordered_map<u32, vector<ArgType>>& cache() {
-        static unordered_map<u32, vector<ArgType>> _cache;
-        return _cache;
-    };
+    // NOTE(panmar): Words of `applied` that match the GL state
+    static u32& known_words() {
+        static u32 _known_words = 0;
+        return _known_words;
+    }
+
+    static array<i32, 4>& current_viewport() {
+        static array<i32, 4> _viewport = {};
+        return _viewport;
+    }
+
+    static bool& viewport_valid() {
+        static bool _viewport_valid = false;
+        return _viewport_valid;
+    }
+
+    static u32& current_framebuffer() {
+        static u32 _framebuffer = 0;
+        return _framebuffer;
+    }
+
+    static bool& framebuffer_valid() {
+        static bool _framebuffer_valid = false;
+        return _framebuffer_valid;
+    }
+};
+
+// NOTE(panmar): Shadow of the texture and sampler bound to each texture unit.
+// Binds are only recorded; flush() issues them right before a draw, as one
+// glBindTextures and one glBindSamplers over the units that changed.
+class TextureUnitCache {
+public:
+    static constexpr u32 MAX_UNITS = 32;
 
-    template <class... ParamType>
-    static bool check_and_set(FuncType func_id, ParamType... params) {
-        vector<ArgType> p{params...};
+    // NOTE(panmar): Sampler 0 samples with the texture's own parameters
+    static void bind(u32 unit, u32 texture, u32 sampler) {
+        if (unit >= MAX_UNITS) {
+            throw PlayGlException(
+                fmt::format("Texture unit {} is out of range", unit));
+        }
+
+        auto& units = table();
+        units.textures[unit] = texture;
+        units.samplers[unit] = sampler;
+        if (texture != units.bound_textures[unit] ||
+            sampler != units.bound_samplers[unit]) {
+            units.first_dirty = std::min(units.first_dirty, unit);
+            units.last_dirty = std::max(units.last_dirty, unit);
+        }
+    }
 
-        auto it = cache().find(func_id);
-        if (it == cache().end()) {
-            cache().insert({func_id, p});
-            return false;
+    // NOTE(panmar): Returns the number of bind calls issued
+    static u32 flush() {
+        auto& units = table();
+        if (units.first_dirty > units.last_dirty) {
+            return 0;
         }
 
-        if (std::equal(it->second.begin(), it->second.end(), p.begin(),
-                       p.end())) {
-            return true;
+        auto first = units.first_dirty;
+        auto count = units.last_dirty - first + 1;
+        auto differs = [first, count](const array<u32, MAX_UNITS>& lhs,
+                                      const array<u32, MAX_UNITS>& rhs) {
+            auto begin = lhs.begin() + first;
+            return !std::equal(begin, begin + count, rhs.begin() + first);
+        };
+
+        u32 calls = 0;
+        if (differs(units.textures, units.bound_textures)) {
+            glBindTextures(first, count, units.textures.data() + first);
+            ++calls;
         }
+        if (differs(units.samplers, units.bound_samplers)) {
+            glBindSamplers(first, count, units.samplers.data() + first);
+            ++calls;
+        }
+
+        units.bound_textures = units.textures;
+        units.bound_samplers = units.samplers;
+        units.first_dirty = MAX_UNITS;
+        units.last_dirty = 0;
+        return calls;
+    }
+
+    // NOTE(panmar): After textures were bound behind the cache's back; every
+    // unit is bound again on the next flush
+    static void clear() {
+        auto& units = table();
+        units.bound_textures.fill(UNKNOWN);
+        units.bound_samplers.fill(UNKNOWN);
+        units.first_dirty = 0;
+        units.last_dirty = MAX_UNITS - 1;
+    }
+
+    // NOTE(panmar): Deleting a texture or sampler unbinds it from every unit,
+    // and its name may be reused right away
+    static void forget_texture(u32 texture) {
+        forget(texture, table().textures, table().bound_textures);
+    }
 
-        cache().erase(func_id);
-        cache().insert({func_id, p});
-        return false;
+    static void forget_sampler(u32 sampler) {
+        forget(sampler, table().samplers, table().bound_samplers);
+    }
+
+private:
+    static constexpr u32 UNKNOWN = std::numeric_limits<u32>::max();
+
+    struct Table {
+        array<u32, MAX_UNITS> textures = {};
+        array<u32, MAX_UNITS> samplers = {};
+        array<u32, MAX_UNITS> bound_textures = {};
+        array<u32, MAX_UNITS> bound_samplers = {};
+        u32 first_dirty = MAX_UNITS;
+        u32 last_dirty = 0;
+    };
+
+    static void forget(u32 name, array<u32, MAX_UNITS>& wanted,
+                       array<u32, MAX_UNITS>& bound) {
+        for (u32 unit = 0; unit < MAX_UNITS; ++unit) {
+            if (wanted[unit] == name) {
+                wanted[unit] = 0;
+            }
+            if (bound[unit] == name) {
+                bound[unit] = 0;
+            }
+        }
+    }
+
+    static Table& table() {
+        static Table _table;
+        return _table;
     }
 };
 
@@ -165,86 +402,81 @@ public:
         FrontAndBack = GL_FRONT_AND_BACK
     };
 
+    GpuState() {
+        using Block = GpuStateBlock;
+        auto& words = block.words;
+        words[Block::ENABLES] = Block::DEPTH_TEST | Block::CULL;
+        if (config::multisampling) {
+            words[Block::ENABLES] |= Block::MULTISAMPLE;
+        }
+        words[Block::CLIP_ORIGIN] = GL_LOWER_LEFT;
+        words[Block::CLIP_DEPTH] =
+            config::inverse_depth ? GL_ZERO_TO_ONE : GL_NEGATIVE_ONE_TO_ONE;
+        words[Block::BLEND_SRC] = static_cast<u32>(BlendMode::One);
+        words[Block::BLEND_DST] = static_cast<u32>(BlendMode::Zero);
+        words[Block::BLEND_EQUATION] = static_cast<u32>(BlendEquation::Add);
+        words[Block::DEPTH_MASK] = GL_TRUE;
+        words[Block::DEPTH_FUNC] = config::inverse_depth ? GL_GREATER : GL_LESS;
+        words[Block::CULL_FACE] = static_cast<u32>(CullFaceMode::Back);
+        words[Block::POLYGON_MODE] = GL_FILL;
+        block.rehash();
+    }
+
     GpuState& blend(BlendMode src = BlendMode::One,
                     BlendMode dst = BlendMode::Zero,
                     BlendEquation eq = BlendEquation::Add,
                     Color color = {0.f, 0.f, 0.f, 0.f}) {
-        _blend = true;
-        _src_blend_mode = src;
-        _dst_blend_mode = dst;
-        _blend_equation = eq;
-        _blend_color = color;
+        using Block = GpuStateBlock;
+        block.words[Block::ENABLES] |= Block::BLEND;
+        block.words[Block::BLEND_SRC] = static_cast<u32>(src);
+        block.words[Block::BLEND_DST] = static_cast<u32>(dst);
+        block.words[Block::BLEND_EQUATION] = static_cast<u32>(eq);
+        block.set(Block::BLEND_COLOR, color.r);
+        block.set(static_cast<Block::Word>(Block::BLEND_COLOR + 1), color.g);
+        block.set(static_cast<Block::Word>(Block::BLEND_COLOR + 2), color.b);
+        block.set(static_cast<Block::Word>(Block::BLEND_COLOR + 3), color.a);
+        block.rehash();
         return *this;
     }
 
     GpuState& nodepth() {
-        _depth_test = false;
+        block.words[GpuStateBlock::ENABLES] &= ~GpuStateBlock::DEPTH_TEST;
+        block.rehash();
         return *this;
     }
 
     GpuState& nodepth_write() {
-        _depth_write = false;
+        block.words[GpuStateBlock::DEPTH_MASK] = GL_FALSE;
+        block.rehash();
         return *this;
     }
 
     GpuState& nocull() {
-        _cull_face = false;
+        block.words[GpuStateBlock::ENABLES] &= ~GpuStateBlock::CULL;
+        block.rehash();
         return *this;
     }
 
     GpuState& wireframe() {
-        _wireframe = true;
+        block.words[GpuStateBlock::POLYGON_MODE] = GL_LINE;
+        block.rehash();
         return *this;
     }
 
     void bind() const {
         bind_lock = true;
+        GpuStateCache::apply(block);
+    }
 
-        if (config::multisampling) {
-            GpuStateCache::glEnable(GL_MULTISAMPLE);
-        }
-
-        if (config::inverse_depth) {
-            GpuStateCache::glClipControl(GL_LOWER_LEFT, GL_ZERO_TO_ONE);
-        }
-
-        if (_blend) {
-            GpuStateCache::glEnable(GL_BLEND);
-            GpuStateCache::glBlendFunc(static_cast<u32>(_src_blend_mode),
-                                       static_cast<u32>(_dst_blend_mode));
-            GpuStateCache::glBlendEquation(static_cast<u32>(_blend_equation));
-            GpuStateCache::glBlendColor(_blend_color.r, _blend_color.g,
-                                        _blend_color.b, _blend_color.a);
-        } else {
-            GpuStateCache::glDisable(GL_BLEND);
-        }
-
-        if (_depth_test) {
-            GpuStateCache::glEnable(GL_DEPTH_TEST);
-            GpuStateCache::glDepthMask(_depth_write);
+    bool operator==(const GpuState& other) const {
+        return block.hash == other.block.hash &&
+               block.words == other.block.words;
+    }
 
-            if (config::inverse_depth) {
-                GpuStateCache::glDepthFunc(GL_GREATER);
-            } else {
-                GpuStateCache::glDepthFunc(GL_LESS);
-            }
-        } else {
-            GpuStateCache::glDisable(GL_DEPTH_TEST);
-        }
+    bool operator!=(const GpuState& other) const { return !(*this == other); }
 
-        if (_cull_face) {
-            GpuStateCache::glEnable(GL_CULL_FACE);
-            GpuStateCache::glCullFace(static_cast<i32>(_cull_face_mode));
-        } else {
-            GpuStateCache::glDisable(GL_CULL_FACE);
-        }
-
-        if (_wireframe) {
-            GpuStateCache::glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-        } else {
-            GpuStateCache::glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-        }
-    }
+    // NOTE(panmar): Computed when the state is built, not per comparison
+    u64 hash() const { return block.hash; }
 
     void unbind() const {
         if (!bind_lock) {
@@ -256,18 +488,5 @@ public:
 
 private:
     mutable bool bind_lock = false;
-
-    bool _blend = false;
-    BlendMode _src_blend_mode = BlendMode::One;
-    BlendMode _dst_blend_mode = BlendMode::Zero;
-    BlendEquation _blend_equation = BlendEquation::Add;
-    Color _blend_color = {0.f, 0.f, 0.f, 0.f};
-
-    bool _depth_test = true;
-    bool _depth_write = true;
-
-    bool _cull_face = true;
-    CullFaceMode _cull_face_mode = CullFaceMode::Back;
-
-    bool _wireframe = false;
+    GpuStateBlock block;
 };
\ No newline at end of file
@@ -0,0 +1,273 @@
+#pragma once
+
+#include <glad/glad.h>
+#define GLFW_INCLUDE_GLU
+#include <GLFW/glfw3.h>
+
+#include "common.h"
+#include "graphics/shader.h"
+#include "resource.h"
+#include "store.h"
+
+struct StoreUniformBufferStats {
+    u32 members = 0;
+    u32 size = 0;
+    u32 dirty_ranges = 0;
+    u32 bytes_uploaded = 0;
+};
+
+// NOTE(panmar): Store params annotated with `StoreParam::Shader` mirrored into
+// a single std140 uniform block, uploaded once per frame instead of once per
+// draw. Shaders opt in with a line containing only
+//
+//     #pragma store
+//
+// which is replaced with the generated block declaration; params are then
+// read as `store.NAME`. Every member is also defined as `STORE_NAME`, so
+// shaders can fall back to a plain uniform for params an app did not set.
+//
+// The layout is append-only: a param gets its offset when it is first seen
+// and keeps it, so programs linked against an older, shorter block stay
+// valid. Values are compared against a shadow copy and only the changed
+// ranges are uploaded.
+class StoreUniformBuffer : public LazyResource<u32> {
+public:
+    StoreUniformBuffer(Store& store)
+        : LazyResource(store_uniform_buffer_deleter), store(store) {
+        Shader::store_block_declaration = declaration();
+    }
+
+    StoreUniformBuffer(const StoreUniformBuffer&) = delete;
+    StoreUniformBuffer& operator=(const StoreUniformBuffer&) = delete;
+
+    // NOTE(panmar): Call once per frame, after the store was updated and
+    // before anything is drawn
+    void update() {
+        if (layout_version != store.version()) {
+            update_layout();
+        }
+
+        current_stats = {};
+        current_stats.members = members.size();
+        current_stats.size = shadow.size();
+
+        // NOTE(panmar): std140 rounds the block size up to 16 bytes, and an
+        // empty block still holds a placeholder
+        auto block_size = (static_cast<u32>(shadow.size()) + 15) / 16 * 16;
+        auto required_size = std::max<u32>(block_size, 16);
+        if (resource() && buffer_size < required_size) {
+            // NOTE(panmar): Grow geometrically, the new storage starts empty
+            buffer_size = std::max(required_size, 2 * buffer_size);
+            glNamedBufferData(resource(), buffer_size, nullptr,
+                              GL_DYNAMIC_DRAW);
+            std::fill(written.begin(), written.end(), false);
+        }
+
+        collect_dirty_ranges();
+        upload_dirty_ranges();
+
+        glBindBufferBase(GL_UNIFORM_BUFFER, Shader::STORE_BLOCK_BINDING,
+                         resource());
+    }
+
+    const StoreUniformBufferStats& stats() const { return current_stats; }
+
+private:
+    struct Member {
+        const StoreParam* param = nullptr;
+        string name;
+        size_t type_index = 0;
+        u32 offset = 0;
+        u32 size = 0;
+    };
+
+    struct Range {
+        u32 begin = 0;
+        u32 end = 0;
+    };
+
+    // NOTE(panmar): std140 type, alignment and size of a store param type;
+    // nullopt for types that cannot live in the block
+    struct Std140Type {
+        const char* glsl_type;
+        u32 alignment;
+        u32 size;
+    };
+
+    static optional<Std140Type> std140_type(const StoreParam::ParamType& v) {
+        return std::visit(
+            [](auto&& arg) -> optional<Std140Type> {
+                using T = std::decay_t<decltype(arg)>;
+                if constexpr (std::is_same_v<T, i32>) {
+                    return Std140Type{"int", 4, 4};
+                } else if constexpr (std::is_same_v<T, f32>) {
+                    return Std140Type{"float", 4, 4};
+                } else if constexpr (std::is_same_v<T, vec3>) {
+                    return Std140Type{"vec3", 16, 12};
+                } else if constexpr (std::is_same_v<T, vec4> ||
+                                     std::is_same_v<T, Color>) {
+                    return Std140Type{"vec4", 16, 16};
+                } else if constexpr (std::is_same_v<T, mat4>) {
+                    // NOTE(panmar): Row major, to match the transposed
+                    // upload of plain matrix uniforms
+                    return Std140Type{"layout(row_major) mat4", 16, 64};
+                } else {
+                    return std::nullopt;
+                }
+            },
+            v);
+    }
+
+    // NOTE(panmar): Params that are not valid glsl names are left out of the
+    // block; the keyword list is not complete, only likely param names
+    static bool is_glsl_identifier(const string& name) {
+        static const unordered_set<string> keywords = {
+            "active", "buffer", "common",  "filter",  "flat",   "in",
+            "input",  "layout", "out",     "output",  "sample", "shared",
+            "smooth", "struct", "texture", "uniform", "bool",   "int",
+            "float",  "double", "vec2",    "vec3",    "vec4",   "mat4",
+            "store"};
+        if (name.empty() || std::isdigit(static_cast<u8>(name[0])) ||
+            name.rfind("gl_", 0) == 0 || keywords.count(name)) {
+            return false;
+        }
+        return std::all_of(name.begin(), name.end(), [](char c) {
+            return std::isalnum(static_cast<u8>(c)) || c == '_';
+        });
+    }
+
+    void update_layout() {
+        vector<std::pair<const string*, const StoreParam*>> added;
+        for (auto& [name, param] : store) {
+            if (!known_params.count(&param) &&
+                param.has(StoreParam::Shader) && is_glsl_identifier(name) &&
+                std140_type(param.param)) {
+                added.push_back({&name, &param});
+            }
+        }
+
+        // NOTE(panmar): Sorted, so the layout does not depend on the order
+        // of the store's hash map
+        std::sort(added.begin(), added.end(),
+                  [](auto& lhs, auto& rhs) { return *lhs.first < *rhs.first; });
+
+        for (auto& [name, param] : added) {
+            auto type = *std140_type(param->param);
+            auto offset =
+                (static_cast<u32>(shadow.size()) + type.alignment - 1) /
+                type.alignment * type.alignment;
+
+            known_params.insert(param);
+            members.push_back(
+                {param, *name, param->param.index(), offset, type.size});
+            shadow.resize(offset + type.size, 0);
+        }
+        written.resize(members.size(), false);
+
+        layout_version = store.version();
+        if (!added.empty()) {
+            Shader::store_block_declaration = declaration();
+        }
+    }
+
+    string declaration() const {
+        string result = "layout(std140) uniform Store {\n";
+        for (auto& member : members) {
+            auto type = *std140_type(member.param->param);
+            result += fmt::format("    {} {};\n", type.glsl_type, member.name);
+        }
+        if (members.empty()) {
+            // NOTE(panmar): Glsl does not allow empty blocks
+            result += "    int _empty;\n";
+        }
+        result += "} store;\n";
+        for (auto& member : members) {
+            result += fmt::format("#define STORE_{}\n", member.name);
+        }
+        return result;
+    }
+
+    void collect_dirty_ranges() {
+        dirty_ranges.clear();
+        for (u32 i = 0; i < members.size(); ++i) {
+            auto& member = members[i];
+            // NOTE(panmar): A param that changed its type keeps the last
+            // value of its original type
+            if (member.param->param.index() != member.type_index) {
+                continue;
+            }
+
+            auto data = std::visit(
+                [](auto&& arg) -> const void* {
+                    using T = std::decay_t<decltype(arg)>;
+                    if constexpr (std::is_same_v<T, string>) {
+                        return nullptr;
+                    } else if constexpr (std::is_same_v<T, Color>) {
+                        return arg.data;
+                    } else {
+                        return &arg;
+                    }
+                },
+                member.param->param);
+
+            auto target = shadow.data() + member.offset;
+            if (written[i] && std::memcmp(target, data, member.size) == 0) {
+                continue;
+            }
+            std::memcpy(target, data, member.size);
+            written[i] = true;
+
+            auto end = member.offset + member.size;
+            if (!dirty_ranges.empty() &&
+                member.offset - dirty_ranges.back().end <= MERGE_DISTANCE) {
+                dirty_ranges.back().end = end;
+            } else {
+                dirty_ranges.push_back({member.offset, end});
+            }
+        }
+    }
+
+    void upload_dirty_ranges() {
+        if (dirty_ranges.empty()) {
+            return;
+        }
+
+        for (auto& range : dirty_ranges) {
+            glNamedBufferSubData(resource(), range.begin,
+                                 range.end - range.begin,
+                                 shadow.data() + range.begin);
+            current_stats.bytes_uploaded += range.end - range.begin;
+        }
+        current_stats.dirty_ranges = dirty_ranges.size();
+    }
+
+    virtual u32 create_resource() const override {
+        u32 buffer = 0;
+        glCreateBuffers(1, &buffer);
+        debug::label("store_uniform_buffer", GL_BUFFER, buffer);
+        return buffer;
+    }
+
+    static void store_uniform_buffer_deleter(u32& resource) {
+        if (resource) {
+            glDeleteBuffers(1, &resource);
+            resource = 0;
+        }
+    }
+
+    // NOTE(panmar): Changed params closer than this are uploaded as a single
+    // range, the gap is re-uploaded unchanged
+    static constexpr u32 MERGE_DISTANCE = 64;
+
+    Store& store;
+    u64 layout_version = std::numeric_limits<u64>::max();
+
+    vector<Member> members;
+    unordered_set<const StoreParam*> known_params;
+    vector<u8> shadow;
+    vector<bool> written;
+    vector<Range> dirty_ranges;
+    u32 buffer_size = 0;
+
+    StoreUniformBufferStats current_stats;
+};
@@ -0,0 +1,137 @@
+#pragma once
+
+#include <glad/glad.h>
+#define GLFW_INCLUDE_GLU
+#include <GLFW/glfw3.h>
+
+#include "common.h"
+#include "resource.h"
+
+// NOTE(panmar): Persistently mapped ring buffer for data that lives for a
+// single frame. The buffer is split into FRAME_COUNT regions; each frame
+// writes into its own region, and a fence guards the region until the gpu
+// has consumed it.
+class StreamBuffer : public LazyResource<u32> {
+public:
+    static constexpr u32 FRAME_COUNT = 3;
+
+    struct Allocation {
+        u32 buffer = 0;
+        u32 offset = 0;
+        u8* data = nullptr;
+    };
+
+    StreamBuffer(u32 frame_size, const string& label = "")
+        : LazyResource(stream_buffer_deleter),
+          frame_size(frame_size),
+          label(label) {}
+
+    StreamBuffer(const StreamBuffer&) = delete;
+    StreamBuffer& operator=(const StreamBuffer&) = delete;
+
+    ~StreamBuffer() {
+        for (auto& fence : fences) {
+            if (fence) {
+                glDeleteSync(fence);
+                fence = nullptr;
+            }
+        }
+    }
+
+    // NOTE(panmar): Returns nullopt when the current frame region is full
+    optional<Allocation> allocate(u32 size, u32 alignment = 16) {
+        auto buffer = resource();
+        auto offset = (head + alignment - 1) / alignment * alignment;
+        if (offset + size > frame_size) {
+            return std::nullopt;
+        }
+
+        head = offset + size;
+
+        auto region_offset = current_frame * frame_size;
+        return Allocation{buffer, region_offset + offset,
+                          mapped_data + region_offset + offset};
+    }
+
+    // NOTE(panmar): Bytes left in the current frame region for an allocation
+    // with the given alignment
+    u32 available(u32 alignment = 16) const {
+        auto offset = (head + alignment - 1) / alignment * alignment;
+        return offset < frame_size ? frame_size - offset : 0;
+    }
+
+    // NOTE(panmar): Also used mid-frame to move on to the next region once
+    // the current one is full; waits until the gpu has released it
+    void next_frame() {
+        if (!mapped_data) {
+            return;
+        }
+
+        fences[current_frame] =
+            glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        current_frame = (current_frame + 1) % FRAME_COUNT;
+        head = 0;
+
+        wait(fences[current_frame]);
+    }
+
+    u32 capacity() const { return frame_size; }
+
+private:
+    virtual u32 create_resource() const override {
+        constexpr auto flags =
+            GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        auto size = static_cast<GLsizeiptr>(frame_size) * FRAME_COUNT;
+
+        u32 buffer = 0;
+        glCreateBuffers(1, &buffer);
+        glNamedBufferStorage(buffer, size, nullptr, flags);
+        mapped_data =
+            static_cast<u8*>(glMapNamedBufferRange(buffer, 0, size, flags));
+
+        if (!mapped_data) {
+            throw PlayGlException("Failed to map stream buffer");
+        }
+
+        debug::label(label, GL_BUFFER, buffer);
+
+        return buffer;
+    }
+
+    static void wait(GLsync& fence) {
+        if (!fence) {
+            return;
+        }
+
+        constexpr u64 timeout_ns = 1000000;
+        while (true) {
+            auto result =
+                glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, timeout_ns);
+            if (result == GL_ALREADY_SIGNALED ||
+                result == GL_CONDITION_SATISFIED) {
+                break;
+            }
+            if (result == GL_WAIT_FAILED) {
+                throw PlayGlException("Waiting for stream buffer fence failed");
+            }
+        }
+
+        glDeleteSync(fence);
+        fence = nullptr;
+    }
+
+    static void stream_buffer_deleter(u32& resource) {
+        if (resource) {
+            glDeleteBuffers(1, &resource);
+            resource = 0;
+        }
+    }
+
+    const u32 frame_size;
+    const string label;
+
+    mutable u8* mapped_data = nullptr;
+    u32 current_frame = 0;
+    u32 head = 0;
+    array<GLsync, FRAME_COUNT> fences = {};
+};
@@ -10,6 +10,8 @@
 #include <stb_image_write.h>
 
 #include "common.h"
+#include "graphics/sampler.h"
+#include "graphics/state.h"
 #include "resource.h"
 
 struct TextureDesc {
@@ -25,20 +27,39 @@ struct TextureDesc {
     f32 aspect_ratio() const { return static_cast<f32>(width) / height; }
 };
 
+class Texture;
+
+// NOTE(panmar): A texture param sampled with a sampler object instead of the
+// texture's own parameters; both have to outlive the draw that uses them
+struct SampledTexture {
+    const Texture* texture = nullptr;
+    const Sampler* sampler = nullptr;
+
+    bool operator==(const SampledTexture& other) const {
+        return texture == other.texture && sampler == other.sampler;
+    }
+};
+
 class Texture : public LazyResource<u32> {
 public:
     static Texture from_file(const Path& path) { return Texture{path}; }
 
     static Texture from_desc(const TextureDesc& desc) { return Texture{desc}; }
 
-    void bind(u32 slot = 0) const {
+    // NOTE(panmar): Recorded in TextureUnitCache, and bound together with the
+    // other textures of the draw
+    void bind(u32 slot = 0, const Sampler* sampler = nullptr) const {
         if (resource()) {
-            glActiveTexture(GL_TEXTURE0 + slot);
-            glBindTexture(GL_TEXTURE_2D, resource());
+            TextureUnitCache::bind(slot, resource(),
+                                   sampler ? sampler->resource() : 0);
         }
     }
 
-    void unbind() const { glBindTexture(GL_TEXTURE_2D, 0); }
+    void unbind(u32 slot = 0) const { TextureUnitCache::bind(slot, 0, 0); }
+
+    SampledTexture with(const Sampler& sampler) const {
+        return {this, &sampler};
+    }
 
     // NOTE(panmar): If the texture was created from desc it is stored here
     mutable TextureDesc desc;
@@ -50,82 +71,81 @@ private:
     Texture(const TextureDesc& desc)
         : LazyResource(texture_resource_deleter), desc(desc) {}
 
+    // NOTE(panmar): Textures are created and filled with direct state access,
+    // so creating one never changes what is bound to the texture units
     virtual u32 create_resource() const override {
         if (path.empty()) {
             return create_texture_from_desc(desc);
         }
-        u32 resource = create_texture_from_path(path);
-
-        {
-            i32 width = 0, height = 0;
-            glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH,
-                                     &width);
-            glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT,
-                                     &height);
-            desc.width = width;
-            desc.height = height;
-        }
+        u32 resource = create_texture_from_path(path, desc);
 
         {
-            debug::label(path.filename().string(), GL_PROGRAM, resource);
+            debug::label(path.filename().string(), GL_TEXTURE, resource);
         }
 
         return resource;
     }
 
-    static u32 create_texture_from_path(const Path& path) {
-        u32 texture = 0;
-        glGenTextures(1, &texture);
-        glBindTexture(GL_TEXTURE_2D, texture);
-
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
-                        GL_LINEAR_MIPMAP_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
+    static u32 create_texture_from_path(const Path& path, TextureDesc& desc) {
         stbi_set_flip_vertically_on_load(true);
         i32 width, height, channels;
         unique_ptr<u8, decltype(&image_data_deleter)> buffer{
             stbi_load(path.string().c_str(), &width, &height, &channels, 0),
             image_data_deleter};
-        auto format = (channels == 3) ? GL_SRGB : GL_SRGB_ALPHA;
-        if (buffer) {
-            glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, GL_RGB,
-                         GL_UNSIGNED_BYTE, buffer.get());
-            glGenerateMipmap(GL_TEXTURE_2D);
-        } else {
+        if (!buffer) {
             throw PlayGlException("Failed to load texture");
         }
 
-        glBindTexture(GL_TEXTURE_2D, 0);
+        desc.width = width;
+        desc.height = height;
+
+        u32 texture = 0;
+        glCreateTextures(GL_TEXTURE_2D, 1, &texture);
+
+        glTextureParameteri(texture, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTextureParameteri(texture, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTextureParameteri(texture, GL_TEXTURE_MIN_FILTER,
+                            GL_LINEAR_MIPMAP_LINEAR);
+        glTextureParameteri(texture, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+        // NOTE(panmar): Immutable storage needs the full mip chain up front
+        auto levels = 1 + static_cast<i32>(std::floor(
+                              std::log2(std::max(width, height))));
+        auto format = (channels == 3) ? GL_SRGB8 : GL_SRGB8_ALPHA8;
+        auto data_format = (channels == 3) ? GL_RGB : GL_RGBA;
+        glTextureStorage2D(texture, levels, format, width, height);
+        // NOTE(panmar): Rows of RGB data are not 4-byte aligned in general
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTextureSubImage2D(texture, 0, 0, 0, width, height, data_format,
+                            GL_UNSIGNED_BYTE, buffer.get());
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        glGenerateTextureMipmap(texture);
 
         return texture;
     }
 
     static u32 create_texture_from_desc(const TextureDesc& desc) {
         u32 texture = 0;
-        glGenTextures(1, &texture);
-        glBindTexture(GL_TEXTURE_2D, texture);
+        glCreateTextures(GL_TEXTURE_2D, 1, &texture);
 
         if (desc.format == TextureDesc::Format::Depth32) {
-            glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH_COMPONENT32F, desc.width,
-                           desc.height);
+            glTextureStorage2D(texture, 1, GL_DEPTH_COMPONENT32F, desc.width,
+                               desc.height);
         } else {
-            glTexStorage2D(GL_TEXTURE_2D, 1, static_cast<i32>(desc.format),
-                           desc.width, desc.height);
+            glTextureStorage2D(texture, 1, static_cast<i32>(desc.format),
+                               desc.width, desc.height);
         }
 
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
-                        static_cast<i32>(desc.min_filter));
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER,
-                        static_cast<i32>(desc.max_filter));
-        glBindTexture(GL_TEXTURE_2D, 0);
+        glTextureParameteri(texture, GL_TEXTURE_MIN_FILTER,
+                            static_cast<i32>(desc.min_filter));
+        glTextureParameteri(texture, GL_TEXTURE_MAG_FILTER,
+                            static_cast<i32>(desc.max_filter));
         return texture;
     }
 
     static void texture_resource_deleter(u32& resource) {
         if (resource) {
+            TextureUnitCache::forget_texture(resource);
             glDeleteTextures(1, &resource);
             resource = 0;
         }
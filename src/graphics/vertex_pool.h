@@ -0,0 +1,125 @@
+#pragma once
+
+#include <glad/glad.h>
+#define GLFW_INCLUDE_GLU
+#include <GLFW/glfw3.h>
+
+#include "common.h"
+
+// NOTE(panmar): Vertex and index data of many geometries suballocated from a
+// few large buffers (pages). Draws from the same page share their vertex and
+// element buffers, so they can be merged into a single multi-draw and
+// addressed with base vertex / first index.
+class VertexPool {
+public:
+    struct Allocation {
+        u32 page = 0;
+        u32 buffer = 0;
+        u32 offset = 0;
+        u32 size = 0;
+    };
+
+    VertexPool(u32 page_size, const string& label = "")
+        : page_size(page_size), label(label) {}
+
+    VertexPool(const VertexPool&) = delete;
+    VertexPool& operator=(const VertexPool&) = delete;
+
+    ~VertexPool() {
+        for (auto& page : pages) {
+            glDeleteBuffers(1, &page.buffer);
+        }
+    }
+
+    // NOTE(panmar): Returns nullopt if the data does not fit into a page
+    optional<Allocation> allocate(u32 size, u32 alignment) {
+        if (size > page_size) {
+            return std::nullopt;
+        }
+
+        for (u32 i = 0; i < pages.size(); ++i) {
+            if (auto allocation = allocate(i, size, alignment)) {
+                return allocation;
+            }
+        }
+
+        add_page();
+        return allocate(pages.size() - 1, size, alignment);
+    }
+
+    void release(const Allocation& allocation) {
+        if (!allocation.size) {
+            return;
+        }
+
+        auto& free_ranges = pages[allocation.page].free_ranges;
+        auto it =
+            free_ranges.insert({allocation.offset, allocation.size}).first;
+
+        auto next = std::next(it);
+        if (next != free_ranges.end() &&
+            it->first + it->second == next->first) {
+            it->second += next->second;
+            free_ranges.erase(next);
+        }
+
+        if (it != free_ranges.begin()) {
+            auto prev = std::prev(it);
+            if (prev->first + prev->second == it->first) {
+                prev->second += it->second;
+                free_ranges.erase(it);
+            }
+        }
+    }
+
+    void upload(const Allocation& allocation, u32 offset, u32 size,
+                const void* data) {
+        glNamedBufferSubData(allocation.buffer, allocation.offset + offset,
+                             size, data);
+    }
+
+private:
+    struct Page {
+        u32 buffer = 0;
+        // NOTE(panmar): Offset to size, sorted so neighbours can be merged
+        map<u32, u32> free_ranges;
+    };
+
+    optional<Allocation> allocate(u32 page_index, u32 size, u32 alignment) {
+        auto& page = pages[page_index];
+        for (auto it = page.free_ranges.begin(); it != page.free_ranges.end();
+             ++it) {
+            auto [offset, range_size] = *it;
+            auto aligned = (offset + alignment - 1) / alignment * alignment;
+            auto padding = aligned - offset;
+            if (range_size < padding + size) {
+                continue;
+            }
+
+            page.free_ranges.erase(it);
+            if (padding) {
+                page.free_ranges.insert({offset, padding});
+            }
+            if (auto rest = range_size - padding - size) {
+                page.free_ranges.insert({aligned + size, rest});
+            }
+            return Allocation{page_index, page.buffer, aligned, size};
+        }
+        return std::nullopt;
+    }
+
+    void add_page() {
+        auto& page = pages.emplace_back();
+        glCreateBuffers(1, &page.buffer);
+        glNamedBufferStorage(page.buffer, page_size, nullptr,
+                             GL_DYNAMIC_STORAGE_BIT);
+        page.free_ranges.insert({0, page_size});
+
+        debug::label(fmt::format("{}_{}", label, pages.size() - 1), GL_BUFFER,
+                     page.buffer);
+    }
+
+    const u32 page_size;
+    const string label;
+    vector<Page> pages;
+};
@@ -0,0 +1,168 @@
+#pragma once
+
+#include "common.h"
+#include "mathgl.h"
+#include "graphics/geometry.h"
+
+// NOTE(panmar): Compressed vertex attributes, opted into with
+// `Geometry::quantized`:
+//
+//     position - half4, normalized to the mesh bounds (8 bytes)
+//     normal   - octahedral snorm16x2 (4 bytes)
+//     texcoord - unorm16x2 (4 bytes), only if all texcoords are in [0, 1]
+//
+// Shaders undo the position scale and decode the normal with the helpers in
+// the built-in `phong`/`solid` shaders, driven by the QUANTIZED,
+// QUANTIZATION_OFFSET and QUANTIZATION_SCALE uniforms.
+
+// NOTE(panmar): Maps quantized positions back to mesh space
+struct VertexQuantization {
+    bool enabled = false;
+    vec3 offset = vec3(0.f);
+    vec3 scale = vec3(1.f);
+
+    bool operator==(const VertexQuantization& other) const {
+        return enabled == other.enabled && offset == other.offset &&
+               scale == other.scale;
+    }
+
+    bool operator!=(const VertexQuantization& other) const {
+        return !(*this == other);
+    }
+};
+
+namespace quantization {
+
+inline VertexQuantization bounds(const vector<vec3>& positions) {
+    auto min = vec3(std::numeric_limits<f32>::max());
+    auto max = vec3(std::numeric_limits<f32>::lowest());
+    for (auto& position : positions) {
+        min = glm::min(min, position);
+        max = glm::max(max, position);
+    }
+
+    VertexQuantization result;
+    result.enabled = true;
+    result.offset = (min + max) * 0.5f;
+    // NOTE(panmar): Flat axes still need a non-zero scale
+    result.scale = glm::max((max - min) * 0.5f, vec3(1e-6f));
+    return result;
+}
+
+inline bool texcoords_quantizable(const vector<vec2>& texcoords) {
+    return std::all_of(texcoords.begin(), texcoords.end(), [](auto& uv) {
+        return uv.x >= 0.f && uv.x <= 1.f && uv.y >= 0.f && uv.y <= 1.f;
+    });
+}
+
+inline u64 encode_position(const vec3& position,
+                           const VertexQuantization& bounds) {
+    auto normalized = (position - bounds.offset) / bounds.scale;
+    return glm::packHalf4x16(vec4(normalized, 1.f));
+}
+
+inline vec3 decode_position(u64 encoded, const VertexQuantization& bounds) {
+    return bounds.offset + vec3(glm::unpackHalf4x16(encoded)) * bounds.scale;
+}
+
+inline u32 encode_normal(const vec3& normal) {
+    auto length = glm::abs(normal.x) + glm::abs(normal.y) + glm::abs(normal.z);
+    // NOTE(panmar): Degenerate normals are encoded as +Z rather than NaNs
+    if (length == 0.f) {
+        return glm::packSnorm2x16(vec2(0.f));
+    }
+
+    auto n = normal / length;
+    auto encoded = vec2(n.x, n.y);
+    if (n.z < 0.f) {
+        auto sign = vec2(n.x >= 0.f ? 1.f : -1.f, n.y >= 0.f ? 1.f : -1.f);
+        encoded = (1.f - glm::abs(vec2(n.y, n.x))) * sign;
+    }
+    return glm::packSnorm2x16(encoded);
+}
+
+inline vec3 decode_normal(u32 encoded) {
+    auto e = glm::unpackSnorm2x16(encoded);
+    auto n = vec3(e.x, e.y, 1.f - glm::abs(e.x) - glm::abs(e.y));
+    auto t = glm::max(-n.z, 0.f);
+    n.x += n.x >= 0.f ? -t : t;
+    n.y += n.y >= 0.f ? -t : t;
+    return glm::normalize(n);
+}
+
+inline u32 encode_texcoord(const vec2& texcoord) {
+    return glm::packUnorm2x16(texcoord);
+}
+
+inline vec2 decode_texcoord(u32 encoded) {
+    return glm::unpackUnorm2x16(encoded);
+}
+
+struct Report {
+    u32 float_vertex_size = 0;
+    u32 quantized_vertex_size = 0;
+
+    // NOTE(panmar): In mesh units, relative to the bounds' largest half
+    // extent, in degrees and in texels of a 4k texture respectively
+    f32 max_position_error = 0.f;
+    f32 max_relative_position_error = 0.f;
+    f32 max_normal_error_degrees = 0.f;
+    f32 max_texcoord_error_texels = 0.f;
+
+    bool texcoords_quantized = false;
+};
+
+// NOTE(panmar): Round-trips every attribute through its compressed format
+inline Report report(const Geometry& geometry) {
+    Report result;
+
+    auto has_normals = !geometry.normals.empty();
+    auto has_texcoords = !geometry.texcoords.empty();
+    result.texcoords_quantized =
+        has_texcoords && texcoords_quantizable(geometry.texcoords);
+
+    result.float_vertex_size = sizeof(vec3) +
+                               (has_normals ? sizeof(vec3) : 0) +
+                               (has_texcoords ? sizeof(vec2) : 0);
+    result.quantized_vertex_size =
+        sizeof(u64) + (has_normals ? sizeof(u32) : 0) +
+        (has_texcoords ? (result.texcoords_quantized ? sizeof(u32)
+                                                     : sizeof(vec2))
+                       : 0);
+
+    auto position_bounds = bounds(geometry.positions);
+    auto max_extent = glm::compMax(position_bounds.scale);
+    for (auto& position : geometry.positions) {
+        auto decoded = decode_position(
+            encode_position(position, position_bounds), position_bounds);
+        auto error = glm::length(decoded - position);
+        result.max_position_error = std::max(result.max_position_error, error);
+    }
+    result.max_relative_position_error = result.max_position_error / max_extent;
+
+    for (auto& normal : geometry.normals) {
+        if (normal == vec3(0.f)) {
+            continue;
+        }
+        auto decoded = decode_normal(encode_normal(normal));
+        auto cosine = glm::clamp(glm::dot(decoded, glm::normalize(normal)),
+                                 -1.f, 1.f);
+        result.max_normal_error_degrees = std::max(
+            result.max_normal_error_degrees, glm::degrees(std::acos(cosine)));
+    }
+
+    if (result.texcoords_quantized) {
+        constexpr f32 texture_size = 4096.f;
+        for (auto& texcoord : geometry.texcoords) {
+            auto decoded = decode_texcoord(encode_texcoord(texcoord));
+            auto error = glm::compMax(glm::abs(decoded - texcoord));
+            result.max_texcoord_error_texels =
+                std::max(result.max_texcoord_error_texels,
+                         error * texture_size);
+        }
+    }
+
+    return result;
+}
+
+}  // namespace quantization
@@ -24,6 +24,7 @@ struct System {
     OrbitCameraController camera_controller;
 
     GeometryRenderer geometry{content, store};
+    StoreUniformBuffer store_buffer{store};
     FramebufferContainer framebuffers;
 
     debug::DebugRenderer debug{content, geometry, framebuffers("#__debug__")};
@@ -53,6 +54,9 @@ void on_framebuffer_resize(GLFWwindow* window, i32 width, i32 height);
 class PlayGlApp {
 public:
     void run() {
+        // NOTE(panmar): Includes startup, where shader programs are
+        // precompiled (or loaded from the binary cache)
+        auto startup_start = std::chrono::high_resolution_clock::now();
         if (!startup()) {
             return;
         }
@@ -68,6 +72,8 @@ public:
             on_framebuffer_resize(framebuffer_width, framebuffer_height);
         }
 
+        auto first_frame = true;
+
         while (!glfwWindowShouldClose(window)) {
             auto frame_timer = Timer{};
             system.input.update();
@@ -78,6 +84,7 @@ public:
             system.camera_controller.update(system.camera, system.input);
 
             pgl_update(system);
+            system.store_buffer.update();
 
             // NOTE(panmar): Not sure if I need to clear the cache here;
             // ImGui seems to clean after itself
@@ -96,6 +103,7 @@ public:
             {
                 DEBUG_SCOPE("pgl_render");
                 pgl_render(system);
+                system.geometry.flush();
             }
 
             {
@@ -109,6 +117,7 @@ public:
                     .with("gamma_correction.fs")
                     .param("gamma", config::gamma)
                     .resulting("#gamma_corrected");
+                system.geometry.flush();
                 system.framebuffers("#gamma_corrected").bind();
             }
 
@@ -124,6 +133,18 @@ public:
 
             glfwMakeContextCurrent(window);
             glfwSwapBuffers(window);
+            system.geometry.next_frame();
+            Shader::next_frame();
+
+            if (first_frame) {
+                first_frame = false;
+                report_startup(startup_start);
+            }
+
+            if (system.input.is_key_pressed(config::key_reload_shaders)) {
+                auto reloaded = system.content.reload_changed_shaders();
+                fmt::print("Reloaded {} shader programs\n", reloaded);
+            }
 
             if (system.input.is_key_pressed(config::key_quit)) {
                 glfwSetWindowShouldClose(window, true);
@@ -171,6 +192,7 @@ public:
 private:
     GLFWwindow* window = nullptr;
     System system;
+    f32 precompile_ms = 0.f;
 
     bool startup() {
         if (!glfwInit()) {
@@ -200,6 +222,17 @@ private:
         }
 
         debug::setup_logging();
+        ParallelShaderCompile::setup();
+        if (config::precompile_shaders) {
+            // NOTE(panmar): Programs using `#pragma store` are compiled
+            // against the params set in pgl_init
+            system.store_buffer.update();
+            auto precompile_start = std::chrono::high_resolution_clock::now();
+            system.content.precompile_shaders(system.store);
+            std::chrono::duration<f32, std::milli> elapsed =
+                std::chrono::high_resolution_clock::now() - precompile_start;
+            precompile_ms = elapsed.count();
+        }
 
         glfwSetWindowUserPointer(window, this);
         glfwSetKeyCallback(window, on_key_callback);
@@ -215,6 +248,22 @@ private:
         return true;
     }
 
+    // NOTE(panmar): Time to the first presented frame, with the share spent
+    // on shader programs; compare a cold run (empty shader cache) with a
+    // warm one
+    void report_startup(
+        std::chrono::high_resolution_clock::time_point start) const {
+        std::chrono::duration<f32, std::milli> elapsed =
+            std::chrono::high_resolution_clock::now() - start;
+        auto& shaders = ShaderBinaryCache::stats();
+        fmt::print(
+            "First frame: {:.1f} ms, precompile {:.1f} ms; shader programs: {} "
+            "cached ({:.1f} ms), {} compiled ({:.1f} ms), {} cached binaries "
+            "rejected\n",
+            elapsed.count(), precompile_ms, shaders.loaded, shaders.load_ms,
+            shaders.compiled, shaders.compile_ms, shaders.rejected);
+    }
+
     void shutdown() {
         Gui::shutdown();
         // TODO(panmar): Make sure children are cleaned first
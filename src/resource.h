@@ -32,6 +32,8 @@ public:
     }
 
 protected:
+    bool has_resource() const { return created; }
+
     virtual T create_resource() const = 0;
 
 private:
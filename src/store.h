@@ -24,9 +24,29 @@ struct BoundedParam<Color> {
     f32 max;
 };
 
+// NOTE(panmar): A param baked into shader programs as a `#define` instead of
+// being uploaded as a uniform (see shader_variants.h); meant for params that
+// rarely change, like feature toggles
+template <class T>
+struct SpecializedParam {
+    SpecializedParam(const T& value) : value(value) {}
+    SpecializedParam(const T& value, f32 min, f32 max)
+        : value(value), bounded(true), min(min), max(max) {}
+
+    T value;
+    bool bounded = false;
+    f32 min = 0.f;
+    f32 max = 0.f;
+};
+
 class StoreParam {
 public:
-    enum AnnotationType { Gui = 0b01, Shader = 0b10, Bounded = 0b100 };
+    enum AnnotationType {
+        Gui = 0b01,
+        Shader = 0b10,
+        Bounded = 0b100,
+        Specialize = 0b1000
+    };
 
     operator i32&() { return std::get<i32>(param); }
     operator f32&() { return std::get<f32>(param); }
@@ -60,6 +80,19 @@ public:
         return *this;
     }
 
+    template <typename T>
+    StoreParam& operator=(const SpecializedParam<T>& specialized_param) {
+        this->param = specialized_param.value;
+        this->annotations &= ~AnnotationType::Shader;
+        this->annotations |= AnnotationType::Specialize;
+        if (specialized_param.bounded) {
+            this->annotations |= AnnotationType::Bounded;
+            this->min_bound = specialized_param.min;
+            this->max_bound = specialized_param.max;
+        }
+        return *this;
+    }
+
     // NOTE(panmar): To avoid confusion and reduce number of errors
     // we do store unsigned integers as signed integers;
     template <>
@@ -68,7 +101,9 @@ public:
         return *this;
     }
 
-    bool has(u32 annotation_flags) { return annotations & annotation_flags; }
+    bool has(u32 annotation_flags) const {
+        return annotations & annotation_flags;
+    }
 
     using ParamType =
         std::variant<i32, f32, glm::vec3, glm::vec4, glm::mat4, Color, string>;
@@ -85,6 +120,7 @@ public:
         auto it = named_params.find(name);
         if (it == named_params.end()) {
             it = named_params.insert({name, StoreParam()}).first;
+            ++_version;
         }
         return it->second;
     }
@@ -98,6 +134,11 @@ public:
 
     auto end() { return named_params.end(); }
 
+    // NOTE(panmar): Changes whenever a param is added; params are never
+    // removed, and references to them stay valid
+    u64 version() const { return _version; }
+
 private:
     std::unordered_map<std::string, StoreParam> named_params;
+    u64 _version = 0;
 };